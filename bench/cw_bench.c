@@ -0,0 +1,280 @@
+#include "structures.h"
+#include "file_handler.h"
+#include "pixel_handler.h"
+#include "task_handler.h"
+#include "thread_handler.h"
+#include "arena_handler.h"
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* Sides of the square synthetic images. */
+static const int bench_sizes[] = {512, 1024, 2048};
+
+/* Kinds of content of the synthetic images. */
+static const char *bench_contents[] = {"flat", "rects", "noise"};
+
+/* Number of timed stages of every image: decoding, the functions and encoding. */
+#define STAGE_COUNT 8
+
+/* Names of the stages in the report. */
+static const char *stage_names[STAGE_COUNT] = {
+    "decode", "color_replace", "copy_area", "ornament_rectangle", "ornament_circle", "ornament_semicircles", "filled_rects", "encode"
+};
+
+/**
+ * @brief Returns the time of a monotonic clock in seconds.
+ *
+ * @return double The time in seconds.
+ */
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Returns the next value of a linear congruential generator, so every run gets the same images.
+ *
+ * @param seed A pointer to the state of the generator.
+ *
+ * @return unsigned int The next pseudo-random value.
+ */
+static unsigned int next_random(unsigned int *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+/**
+ * @brief Fills an image with synthetic content.
+ *
+ * @param image A pointer to the Png structure to be filled.
+ * @param size The width and height of the image.
+ * @param content "flat" for a few large areas of one color, "rects" for many filled rectangles on a background, "noise" for random pixels.
+ *
+ * This function does not return a value.
+ *
+ * @note Rectangles are red (255.0.0), the color the benchmarked functions look for.
+ */
+static void make_synthetic_image(Png *image, int size, const char *content) {
+    *image = (Png){0};
+    image->width = size;
+    image->height = size;
+    image->color_type = PNG_COLOR_TYPE_RGB;
+    image->bit_depth = 8;
+    set_pixel_format(image, PNG_COLOR_TYPE_RGB, 8);
+    allocate_png_pixels(image, (size_t)size * 3);
+
+    unsigned int seed = 12345 + size;
+    for (int y = 0; y < size; y++) {
+        png_bytep row = image->row_pointers[y];
+        for (int x = 0; x < size; x++) {
+            png_bytep pixel = row + (size_t)x * 3;
+            if (strcmp(content, "noise") == 0) {
+                unsigned int value = next_random(&seed);
+                pixel[0] = value;
+                pixel[1] = value >> 8;
+                pixel[2] = value >> 16;
+            } else {
+                /* Four bands of flat colors, one of them red */
+                int band = x * 4 / size;
+                pixel[0] = (band == 0) ? 255 : band * 60;
+                pixel[1] = (band == 0) ? 0 : 200 - band * 40;
+                pixel[2] = (band == 0) ? 0 : 90;
+            }
+        }
+    }
+
+    if (strcmp(content, "rects") == 0) {
+        /* Many small red rectangles on a gray background, some of them touching */
+        for (int y = 0; y < size; y++) {
+            memset(image->row_pointers[y], 128, (size_t)size * 3);
+        }
+        int count = size * size / 2048;
+        for (int i = 0; i < count; i++) {
+            int x1 = next_random(&seed) % size;
+            int y1 = next_random(&seed) % size;
+            int x2 = x1 + 2 + next_random(&seed) % 40;
+            int y2 = y1 + 2 + next_random(&seed) % 40;
+            for (int y = y1; y < y2 && y < size; y++) {
+                for (int x = x1; x < x2 && x < size; x++) {
+                    png_bytep pixel = image->row_pointers[y] + (size_t)x * 3;
+                    pixel[0] = 255;
+                    pixel[1] = 0;
+                    pixel[2] = 0;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Compares two times for qsort.
+ *
+ * @param a A pointer to the first time.
+ * @param b A pointer to the second time.
+ *
+ * @return int A negative value, zero or a positive value as a is shorter than, as long as or longer than b.
+ */
+static int compare_times(const void *a, const void *b) {
+    double first = *(const double*)a;
+    double second = *(const double*)b;
+    return (first > second) - (first < second);
+}
+
+/**
+ * @brief Runs one stage on an image.
+ *
+ * @param stage The index of the stage in stage_names.
+ * @param image A pointer to the Png structure, restored from the original pixels before every function.
+ * @param decoded A pointer to the Png structure the encoded file is decoded into.
+ * @param file_name The file the image is encoded to and decoded from.
+ *
+ * This function does not return a value.
+ */
+static void run_stage(int stage, Png *image, Png *decoded, char *file_name) {
+    char left_up[32], right_down[32], dest_left_up[32];
+    int size = image->width;
+
+    switch (stage) {
+        case 0:
+            read_png_file(file_name, decoded);
+            png_destroy_read_struct(&decoded->png_ptr, &decoded->info_ptr, NULL);
+            break;
+        case 1:
+            color_replace(image, "255.0.0", "0.0.255");
+            break;
+        case 2:
+            snprintf(left_up, sizeof(left_up), "%d.%d", size / 4, size / 4);
+            snprintf(right_down, sizeof(right_down), "%d.%d", size * 3 / 4, size * 3 / 4);
+            snprintf(dest_left_up, sizeof(dest_left_up), "%d.%d", size / 8, size / 8);
+            copy_area(image, left_up, right_down, dest_left_up);
+            break;
+        case 3:
+            ornament(image, "rectangle", "0.0.0", "10", "4");
+            break;
+        case 4:
+            ornament(image, "circle", "0.0.0", "10", "4");
+            break;
+        case 5:
+            ornament(image, "semicircles", "0.0.0", "10", "4");
+            break;
+        case 6:
+            filled_rects(image, "255.0.0", "0.255.0", "2");
+            break;
+        case 7:
+            write_png_file(file_name, image, NULL);
+            break;
+    }
+}
+
+/**
+ * @brief Benchmarks every stage on one synthetic image and prints the result as a JSON object.
+ *
+ * @param size The width and height of the image.
+ * @param content The kind of content, see make_synthetic_image.
+ * @param repetitions The number of times every stage is run.
+ * @param file_name The file the image is encoded to and decoded from.
+ *
+ * This function does not return a value.
+ *
+ * @note Run in a process of its own, so the peak resident set size it reports belongs to this image alone.
+ */
+static void bench_image(int size, const char *content, int repetitions, char *file_name) {
+    Png image = {0}, decoded = {0};
+    Arena arena = {0};
+    make_synthetic_image(&image, size, content);
+    use_arena(&arena);
+
+    /* Every function starts from the same pixels */
+    size_t bytes = image.stride * (size_t)image.height;
+    png_bytep original = malloc(bytes);
+    double *times = malloc(sizeof(double) * repetitions);
+    if (original == NULL || times == NULL) {
+        printf("Error: Can not allocate memory for benchmark\n");
+        exit(1);
+    }
+    memcpy(original, image.pixels, bytes);
+    write_png_file(file_name, &image, NULL);
+
+    double megapixels = (double)size * size / 1e6;
+    printf("    {\"content\": \"%s\", \"width\": %d, \"height\": %d, \"mpix_per_s\": {", content, size, size);
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        for (int r = 0; r < repetitions; r++) {
+            memcpy(image.pixels, original, bytes);
+            double start = now();
+            run_stage(stage, &image, &decoded, file_name);
+            reset_arena(&arena);
+            times[r] = now() - start;
+        }
+
+        /* The median is not moved by one-off delays */
+        qsort(times, repetitions, sizeof(double), compare_times);
+        double median = (repetitions % 2) ? times[repetitions / 2] : (times[repetitions / 2 - 1] + times[repetitions / 2]) / 2;
+        printf("%s\"%s\": %.2f", stage ? ", " : "", stage_names[stage], median > 0 ? megapixels / median : 0.0);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("}, \"peak_rss_kib\": %ld}", usage.ru_maxrss);
+
+    use_arena(NULL);
+    free_arena(&arena);
+    free(original);
+    free(times);
+    free_png_pixels(&image);
+    free_png_pixels(&decoded);
+}
+
+/**
+ * @brief Benchmarks decoding, every function and encoding on synthetic images and prints the median speeds as JSON.
+ *
+ * @param argc The number of command-line arguments.
+ * @param argv The arguments: an optional number of repetitions (default: 5) and an optional number of threads (default: 1).
+ *
+ * @return int 0 on success, 1 if an image could not be benchmarked.
+ */
+int main(int argc, char *argv[]) {
+    int repetitions = (argc > 1) ? atoi(argv[1]) : 5;
+    int threads = (argc > 2) ? atoi(argv[2]) : 1;
+    if (repetitions <= 0) {
+        repetitions = 1;
+    }
+    if (threads <= 0) {
+        threads = 1;
+    }
+
+    const char *directory = getenv("TMPDIR");
+    char file_name[256];
+    snprintf(file_name, sizeof(file_name), "%s/cw-bench-%ld.png", directory ? directory : "/tmp", (long)getpid());
+
+    int failed = 0;
+    int first = 1;
+    printf("{\n  \"repetitions\": %d,\n  \"threads\": %d,\n  \"results\": [\n", repetitions, threads);
+    for (size_t s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+        for (size_t c = 0; c < sizeof(bench_contents) / sizeof(bench_contents[0]); c++) {
+            printf("%s", first ? "" : ",\n");
+            first = 0;
+            fflush(stdout);
+
+            /* Every image gets a fresh process, so memory of one image does not count towards the next */
+            pid_t pid = fork();
+            if (pid == 0) {
+                if (threads > 1) {
+                    init_thread_pool(threads);
+                }
+                bench_image(bench_sizes[s], bench_contents[c], repetitions, file_name);
+                fflush(stdout);
+                _exit(0);
+            }
+            int status = 0;
+            if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                failed = 1;
+            }
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    remove(file_name);
+    return failed;
+}
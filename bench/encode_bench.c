@@ -0,0 +1,118 @@
+#include "structures.h"
+#include "file_handler.h"
+#include "preparation_handler.h"
+#include "pixel_handler.h"
+#include <time.h>
+
+/* Size of the synthetic image used when no input file is given. */
+#define BENCH_WIDTH 2048
+#define BENCH_HEIGHT 2048
+
+/* File the encoded images are written to. */
+#define BENCH_OUTPUT "encode_bench.png"
+
+/**
+ * @brief Fills an image with flat areas, gradients and noise, roughly like the images the program works on.
+ * 
+ * @param image A pointer to the Png structure to be filled.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ * 
+ * This function does not return a value.
+ */
+static void make_synthetic_image(Png *image, int width, int height) {
+    *image = (Png){0};
+    image->width = width;
+    image->height = height;
+    image->color_type = PNG_COLOR_TYPE_RGB;
+    image->bit_depth = 8;
+    set_pixel_format(image, PNG_COLOR_TYPE_RGB, 8);
+    allocate_png_pixels(image, (size_t)width * 3);
+
+    unsigned int seed = 12345;
+    for (int y = 0; y < height; y++) {
+        png_bytep row = image->row_pointers[y];
+        for (int x = 0; x < width; x++) {
+            png_bytep pixel = &(row[x * 3]);
+            if (y < height / 3) {
+                /* Flat rectangles */
+                int cell = (x / 128 + y / 96) % 4;
+                pixel[0] = cell * 60;
+                pixel[1] = 255 - cell * 50;
+                pixel[2] = 40;
+            } else if (y < 2 * height / 3) {
+                /* Gradients */
+                pixel[0] = x * 255 / width;
+                pixel[1] = y * 255 / height;
+                pixel[2] = (x + y) & 0xFF;
+            } else {
+                /* Noise */
+                seed = seed * 1103515245 + 12345;
+                pixel[0] = seed >> 24;
+                pixel[1] = seed >> 16;
+                pixel[2] = seed >> 8;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Returns the time of a monotonic clock in seconds.
+ * 
+ * @return double The time in seconds.
+ */
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Encodes one image with every encoder preset and reports the speed and the output size of each.
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The arguments: an optional input PNG file and an optional number of repetitions.
+ * 
+ * @return int 0 on success.
+ */
+int main(int argc, char *argv[]) {
+    Png image = {0};
+    int repetitions = (argc > 2) ? atoi(argv[2]) : 3;
+    if (repetitions <= 0) {
+        repetitions = 1;
+    }
+
+    if (argc > 1) {
+        read_png_file(argv[1], &image);
+    } else {
+        make_synthetic_image(&image, BENCH_WIDTH, BENCH_HEIGHT);
+    }
+    double megabytes = (double)image.width * image.height * image.pixel_bytes / (1024 * 1024);
+
+    char *presets[] = {"default", "fast", "balanced", "small"};
+    printf("%-10s %10s %12s %8s\n", "preset", "MB/s", "bytes", "ratio");
+    for (int i = 0; i < 4; i++) {
+        EncoderSettings settings = {-1, -1, -1, 0, 0};
+        process_encode_preset(presets[i], &settings);
+
+        /* The best of several runs hides one-off delays */
+        double best = 0;
+        for (int r = 0; r < repetitions; r++) {
+            double start = now();
+            write_png_file(BENCH_OUTPUT, &image, &settings);
+            double elapsed = now() - start;
+            if (r == 0 || elapsed < best) {
+                best = elapsed;
+            }
+        }
+
+        struct stat output_stat;
+        stat(BENCH_OUTPUT, &output_stat);
+        printf("%-10s %10.1f %12lld %7.1f%%\n", presets[i], megabytes / best, (long long)output_stat.st_size,
+               100.0 * output_stat.st_size / (megabytes * 1024 * 1024));
+    }
+
+    remove(BENCH_OUTPUT);
+    free_png_pixels(&image);
+    return 0;
+}
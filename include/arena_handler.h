@@ -0,0 +1,14 @@
+#ifndef ARENA_HANDLER_H
+#define ARENA_HANDLER_H
+
+#include "structures.h"
+
+void use_arena(Arena *arena);
+
+void* arena_alloc(size_t size);
+
+void reset_arena(Arena *arena);
+
+void free_arena(Arena *arena);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef BATCH_HANDLER_H
+#define BATCH_HANDLER_H
+
+#include "structures.h"
+
+int run_job(Options options, Png *image);
+
+int run_batch(char* manifest);
+
+#endif
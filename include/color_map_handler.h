@@ -0,0 +1,14 @@
+#ifndef COLOR_MAP_HANDLER_H
+#define COLOR_MAP_HANDLER_H
+
+#include "structures.h"
+
+uint64_t pack_color(const PixelFormat *format, const png_byte *pixel);
+
+ColorMap* create_color_map(size_t expected_count, const PixelFormat *format);
+
+int color_map_insert(ColorMap *map, uint64_t old_color, uint64_t new_color);
+
+void color_map_row(Png *image, png_bytep row, int y, void *context);
+
+#endif
@@ -3,14 +3,34 @@
 
 #include "structures.h"
 
-void draw_pixel(png_bytep ptr, int* color_values);
+void draw_pixel(Png *image, png_bytep ptr, const png_byte* color);
 
-void draw_border(Png *image, int x1, int y1, int x2, int y2, int* border_color, char* thickness);
+void fill_span(Png *image, png_bytep row, int x_begin, int x_end, const png_byte* color);
 
-void rectangle_ornament(Png *image, int ornament_thickness, int ornament_count, int* color_values, char* thickness);
+long long integer_sqrt(long long value);
 
-void circle_ornament(Png *image, int* color_values);
+void draw_border_row(Png *image, png_bytep row, int y, Rect rect, const png_byte* border_color, int border_thickness);
 
-void semicircles_ornament(Png *image, int ornament_thickness, int ornament_count, int* color_values);
+void draw_border(Png *image, int x1, int y1, int x2, int y2, const png_byte* border_color, char* thickness);
+
+void border_batch_row(Png *image, png_bytep row, int y, void *context);
+
+void draw_borders(Png *image, RectList *list, const png_byte* border_color, int border_thickness);
+
+void rectangle_ornament_row(Png *image, png_bytep row, int y, void *context);
+
+void rectangle_ornament(Png *image, int ornament_thickness, int ornament_count, const png_byte* color, char* thickness);
+
+void prepare_rectangle_ornament(Png *image, int ornament_thickness, int ornament_count, const png_byte* color, char* thickness, OrnamentContext *ornament);
+
+void circle_ornament_row(Png *image, png_bytep row, int y, void *context);
+
+void circle_ornament(Png *image, const png_byte* color);
+
+void semicircles_ornament_row(Png *image, png_bytep row, int y, void *context);
+
+void semicircles_ornament(Png *image, int ornament_thickness, int ornament_count, const png_byte* color);
+
+void prepare_semicircles_ornament(Png *image, int ornament_thickness, int ornament_count, const png_byte* color, OrnamentContext *ornament);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,8 @@
+#ifndef ENCODER_HANDLER_H
+#define ENCODER_HANDLER_H
+
+#include "structures.h"
+
+int write_png_rows_parallel(png_structp png_ptr, Png *image, EncoderSettings *settings);
+
+#endif
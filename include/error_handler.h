@@ -0,0 +1,12 @@
+#ifndef ERROR_HANDLER_H
+#define ERROR_HANDLER_H
+
+#include <setjmp.h>
+
+void set_error_recovery(jmp_buf *recovery);
+
+jmp_buf* get_error_recovery();
+
+void raise_error(int code) __attribute__((noreturn));
+
+#endif
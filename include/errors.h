@@ -19,4 +19,13 @@
 /* Error code indicating a failure in memory allocation. */
 #define ERR_MEMORY_ALLOCATION_FAILURE 46
 
+/* Error code indicating that some jobs of a batch failed. */
+#define ERR_BATCH_JOB_FAILURE 47
+
+/* Error code indicating that the server refused a request because its queue or its connections are full. */
+#define ERR_SERVER_BUSY 48
+
+/* Error code indicating that a request to the server is longer than it accepts. */
+#define ERR_REQUEST_TOO_LONG 49
+
 #endif
\ No newline at end of file
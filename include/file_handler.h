@@ -3,8 +3,18 @@
 
 #include "structures.h"
 
+void allocate_png_rows(Png *image, size_t row_bytes, int y_begin, int y_end);
+
+void allocate_png_pixels(Png *image, size_t row_bytes);
+
+void free_png_pixels(Png *image);
+
+void read_png_header(char *file_name, Png *image);
+
 void read_png_file(char *file_name, Png *image);
 
-void write_png_file(char *file_name, Png *image);
+void write_png_file(char *file_name, Png *image, EncoderSettings *settings);
+
+int stream_png_file(char *input_file, char *output_file, HeaderFunction prepare, RowFunction function, WindowFunction process, void *context, EncoderSettings *settings);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,22 @@
+#ifndef IO_HANDLER_H
+#define IO_HANDLER_H
+
+#include "structures.h"
+
+void reserve_stdout();
+
+void open_png_input(char *file_name, PngInput *input);
+
+void set_png_input(png_structp png_ptr, PngInput *input);
+
+void close_png_input(PngInput *input);
+
+void open_png_output(char *file_name, PngOutput *output, size_t buffer_size);
+
+int write_output(PngOutput *output, png_const_bytep data, size_t length);
+
+void set_png_output(png_structp png_ptr, PngOutput *output);
+
+int close_png_output(PngOutput *output, int complete);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef PALETTE_HANDLER_H
+#define PALETTE_HANDLER_H
+
+#include "structures.h"
+
+int rewrite_palette(char *input_file, char *output_file, Operation *operations, int operation_count, EncoderSettings *settings);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef PIPELINE_HANDLER_H
+#define PIPELINE_HANDLER_H
+
+#include "structures.h"
+
+int is_row_local(Operation *operation);
+
+void prepare_pipeline(Png *image, void *context);
+
+int fuse_operations(Operation *operations, int operation_count, Png *image, Pipeline *pipeline);
+
+void fuse_row_local_operations(Operation *operations, int operation_count, Pipeline *pipeline);
+
+void pipeline_row(Png *image, png_bytep row, int y, void *context);
+
+#endif
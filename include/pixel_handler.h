@@ -0,0 +1,10 @@
+#ifndef PIXEL_HANDLER_H
+#define PIXEL_HANDLER_H
+
+#include "structures.h"
+
+int set_pixel_format(Png *image, png_byte color_type, png_byte bit_depth);
+
+void encode_color(const PixelFormat *format, const int *color_values, png_bytep pixel);
+
+#endif
@@ -5,8 +5,12 @@
 
 void handle_arguments(int argc, char *argv[], Options *options);
 
+int process_encode_preset(char* preset, EncoderSettings *settings);
+
 int* process_color(char* string_color);
 
 int* process_coordinates(char* string_coordinates);
 
+ColorMap* process_color_map(char* file_name, const PixelFormat *format);
+
 #endif
\ No newline at end of file
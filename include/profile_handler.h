@@ -0,0 +1,42 @@
+#ifndef PROFILE_HANDLER_H
+#define PROFILE_HANDLER_H
+
+#include "structures.h"
+
+extern int profiling_enabled;
+
+extern ProfileCounters profile_counters;
+
+void enable_profiling();
+
+uint64_t read_clock(clockid_t clock);
+
+void start_profile_timer(ProfileTimer *timer);
+
+void stop_profile_timer(ProfileTimer *timer, ProfileStage stage);
+
+void print_profile(char *input_file, char *output_file, char *batch_file);
+
+/*
+ * Profiling hooks. Building with -DNO_PROFILE (make PROFILE=0) removes them,
+ * otherwise they cost one check of profiling_enabled when --profile is not given.
+ * Removed counters still use their amount, so a variable kept only for them is not unused.
+ */
+#ifdef NO_PROFILE
+#define PROFILE_TIMER(timer)
+#define PROFILE_START(timer) ((void)0)
+#define PROFILE_STOP(timer, stage) ((void)0)
+#define PROFILE_COUNT(counter, amount) ((void)(amount))
+#define PROFILE_MAX(counter, value) ((void)(value))
+#else
+#define PROFILE_TIMER(timer) ProfileTimer timer
+#define PROFILE_START(timer) do { if (profiling_enabled) start_profile_timer(&(timer)); } while (0)
+#define PROFILE_STOP(timer, stage) do { if (profiling_enabled) stop_profile_timer(&(timer), (stage)); } while (0)
+#define PROFILE_COUNT(counter, amount) do { if (profiling_enabled) __atomic_fetch_add(&profile_counters.counter, (uint64_t)(amount), __ATOMIC_RELAXED); } while (0)
+#define PROFILE_MAX(counter, value) do { if (profiling_enabled) { \
+    uint64_t profile_value = (value), profile_seen = __atomic_load_n(&profile_counters.counter, __ATOMIC_RELAXED); \
+    while (profile_seen < profile_value && !__atomic_compare_exchange_n(&profile_counters.counter, &profile_seen, profile_value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)); \
+} } while (0)
+#endif
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef RECTS_HANDLER_H
+#define RECTS_HANDLER_H
+
+#include "structures.h"
+
+void add_rect(RectList *list, Rect rect);
+
+void build_color_bitmap(Png *image, const png_byte* color, PixelBitmap *bitmap);
+
+void find_filled_rects(Png *image, const png_byte* color, const png_byte* border_color, int border_thickness, RectList *list);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef SERVE_HANDLER_H
+#define SERVE_HANDLER_H
+
+#include "structures.h"
+
+void run_server(char *socket_path);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef SIMD_HANDLER_H
+#define SIMD_HANDLER_H
+
+#include "structures.h"
+
+int color_replace_scalar(png_bytep row, int width, const png_byte* old_color, const png_byte* new_color);
+
+ColorReplaceKernel select_color_replace_kernel(const PixelFormat *format);
+
+void masked_copy_scalar(png_bytep destination, png_const_bytep source, int width);
+
+MaskedCopyKernel select_masked_copy_kernel(const PixelFormat *format);
+
+#endif
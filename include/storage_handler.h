@@ -0,0 +1,20 @@
+#ifndef STORAGE_HANDLER_H
+#define STORAGE_HANDLER_H
+
+#include "structures.h"
+
+void set_memory_limit(size_t limit);
+
+png_bytep allocate_pixel_storage(size_t size, int *mapped);
+
+void free_pixel_storage(png_bytep pixels, size_t size, int mapped);
+
+int get_tile_height(Png *image);
+
+void load_rows(Png *image, int y_begin, int y_end);
+
+void release_rows(Png *image, int y_begin, int y_end);
+
+void for_each_tile(Png *image, int y_begin, int y_end, TileFunction function, void *context);
+
+#endif
@@ -2,11 +2,75 @@
 #define STRUCTURES_H
 
 #include <png.h>
+#include <zlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Alignment in bytes of the pixel buffer and of every row inside it (one cache line, enough for AVX-512 loads). */
+#define PIXEL_ALIGNMENT 64
+
+/* Size in bytes of the largest pixel in memory (16-bit RGBA). */
+#define MAX_PIXEL_BYTES 8
+
+/**
+ * @brief Kernel replacing all pixels of one color with another in a single row.
+ *
+ * @param row A pointer to the pixel data of the row.
+ * @param width The number of pixels in the row.
+ * @param old_color The pixel of the color to be replaced, only its color channels are compared.
+ * @param new_color The pixel of the color to replace with, only its color channels are written.
+ *
+ * @return int The number of pixels replaced.
+ */
+typedef int (*ColorReplaceKernel)(png_bytep row, int width, const png_byte* old_color, const png_byte* new_color);
+
+/**
+ * @brief Kernel copying the pixels of a row that have no zero color channel, as the 'copy' function does.
+ *
+ * @param destination A pointer to the pixel data the pixels are copied to.
+ * @param source A pointer to the pixel data the pixels are copied from.
+ * @param width The number of pixels.
+ */
+typedef void (*MaskedCopyKernel)(png_bytep destination, png_const_bytep source, int width);
+
+/**
+ * @brief Kernel setting the bits of a bitmap row for the pixels of a row that have a given color.
+ *
+ * @param row A pointer to the pixel data of the row.
+ * @param width The number of pixels in the row.
+ * @param color The pixel of the color, only its color channels are compared.
+ * @param pattern 8 copies of the pixel of the color, a group of 8 pixels equal to it is matched at once.
+ * @param bits A pointer to the cleared words of the bitmap row.
+ */
+typedef void (*ColorMatchKernel)(png_const_bytep row, int width, const png_byte* color, const png_byte* pattern, uint64_t* bits);
+
+/**
+ * @brief Structure describing a layout of pixels in memory, with the kernels specialized for it.
+ *
+ * @note Alpha is always the last channel. The functions look at the color channels only, keep the alpha of the
+ *       pixels they recolor and draw opaque pixels.
+ */
+typedef struct PixelFormat {
+    png_byte color_type; /**< libpng color type of the pixels (gray, gray with alpha, RGB or RGBA) */
+    png_byte bit_depth; /**< Bits per channel, 8 or 16 */
+    int channels; /**< Number of channels of a pixel, including alpha */
+    int pixel_bytes; /**< Size of a pixel in bytes */
+    int color_bytes; /**< Size in bytes of the color channels at the start of a pixel, without alpha */
+    ColorReplaceKernel color_replace; /**< Scalar color replacement kernel */
+    MaskedCopyKernel masked_copy; /**< Masked copy kernel going from the first pixel */
+    MaskedCopyKernel masked_copy_backward; /**< Masked copy kernel going from the last pixel, for rows overlapping forward */
+    ColorMatchKernel color_match; /**< Kernel building a bitmap row of the pixels of a color */
+} PixelFormat;
 
 /**
  * @brief Structure representing a PNG image.
@@ -14,36 +78,187 @@
 typedef struct Png {
     int width; /**< Width of the image in pixels */
     int height; /**< Height of the image in pixels */
-    png_byte color_type; /**< Color type of the image (e.g., RGB, Grayscale) */
-    png_byte bit_depth; /**< Bit depth of the image */
+    png_byte color_type; /**< Color type of the image in the file (e.g., RGB, Grayscale) */
+    png_byte bit_depth; /**< Bit depth of the image in the file */
+    const struct PixelFormat* format; /**< Layout of the pixels in memory, palette and low bit depth images are expanded to it */
+    int channels; /**< Number of channels of a pixel in memory */
+    int pixel_bytes; /**< Size of a pixel in memory in bytes */
     png_structp png_ptr; /**< Pointer to the libpng structure for reading/writing PNG data */
     png_infop info_ptr; /**< Pointer to the libpng structure for storing PNG information */
     int number_of_passes; /**< Number of passes required for interlacing (typically used for progressive rendering) */
-    png_bytep *row_pointers; /**< Pointer to an array of pointers, each pointing to a row of image data */
+    png_bytep pixels; /**< Single PIXEL_ALIGNMENT-aligned buffer holding all rows of image data */
+    size_t stride; /**< Distance in bytes between the starts of two consecutive rows in pixels */
+    png_bytep *row_pointers; /**< Pointer to an array of pointers, each pointing to a row inside pixels */
+    size_t pixels_capacity; /**< Size in bytes of the buffer pixels points to, kept when the buffer is reused for another image */
+    int rows_capacity; /**< Number of entries of the array row_pointers points to */
+    int pixels_mapped; /**< 1 if pixels is backed by a scratch file because the image is over the memory limit, 0 otherwise */
+    int rows_begin; /**< First row held in pixels, rows outside rows_begin..rows_end are streamed past and have no row pointer */
+    int rows_end; /**< Row after the last one held in pixels */
 } Png;
 
 /**
- * @brief Structure representing an area copied during the execution of the 'copy_area' function.
+ * @brief Function applied to a single row of an image.
+ *
+ * @param image A pointer to the Png structure the row belongs to (only the header fields are guaranteed to be set).
+ * @param row A pointer to the pixel data of the row.
+ * @param y The index of the row in the image.
+ * @param context A pointer to the data the function needs, passed by the caller.
  */
-typedef struct Area {
-    int width; /**< Width of the area in pixels */
-    int height; /**< Height of the area in pixels */
-    png_bytep *row_pointers; /**< Pointer to an array of pointers, each pointing to a row of area data */
-} Area;
+typedef void (*RowFunction)(struct Png *image, png_bytep row, int y, void *context);
 
 /**
- * @brief Structure representing options provided to the program.
+ * @brief Function called once the header of a streamed image is read, before any of its rows.
+ *
+ * @param image A pointer to the Png structure of the image (only the header fields are set).
+ * @param context A pointer to the data the function needs, the same one its row function gets.
  */
-typedef struct {
-    char* input_file; /**< Filename of the input PNG file */
-    char* output_file; /**< Filename of the output PNG file */
-    int flag_help; /**< Flag indicating if the help message should be displayed */
-    int flag_input; /**< Flag indicating if the input file has been specified */
-    int flag_output; /**< Flag indicating if the output file has been specified */
-    int flag_copy; /**< Flag indicating if the 'copy' function should be executed */
-    int flag_color_replace; /**< Flag indicating if the 'color_replace' function should be executed */
-    int flag_ornament; /**< Flag indicating if the 'ornament' function should be executed */
-    int flag_filled_rects; /**< Flag indicating if the 'filled_rects' function should be executed */
+typedef void (*HeaderFunction)(struct Png *image, void *context);
+
+/**
+ * @brief Function applied to the rows of a streamed image held in memory, once all of them are read.
+ *
+ * @param image A pointer to the Png structure of the image, only its rows from rows_begin to rows_end are set.
+ * @param context A pointer to the data the function needs, the same one its row function gets.
+ */
+typedef void (*WindowFunction)(struct Png *image, void *context);
+
+/**
+ * @brief Function applied to the rows of one tile of an image.
+ *
+ * @param image A pointer to the Png structure the rows belong to.
+ * @param y_begin The first row of the tile.
+ * @param y_end The row after the last one of the tile.
+ * @param context A pointer to the data the function needs, passed by the caller.
+ */
+typedef void (*TileFunction)(struct Png *image, int y_begin, int y_end, void *context);
+
+/**
+ * @brief Function run for every task of a parallel job.
+ *
+ * @param index The index of the task, from 0 to the number of tasks - 1.
+ * @param context A pointer to the data the function needs, passed by the caller.
+ */
+typedef void (*TaskFunction)(int index, void *context);
+
+/**
+ * @brief Structure representing the pool of threads that parallel jobs are run on.
+ */
+typedef struct ThreadPool {
+    pthread_t* threads; /**< Worker threads, the first slot is unused as the calling thread works too */
+    int thread_count; /**< Number of threads working on a job, including the calling thread */
+    pthread_mutex_t mutex; /**< Mutex protecting all the fields below */
+    pthread_cond_t work_ready; /**< Signalled when a new job is published */
+    pthread_cond_t work_done; /**< Signalled when the last task of a job is finished */
+    TaskFunction function; /**< Function of the current job */
+    void *context; /**< Context of the current job */
+    int task_count; /**< Number of tasks in the current job */
+    int next_task; /**< Index of the next task to be taken */
+    int finished_tasks; /**< Number of finished tasks of the current job */
+    int generation; /**< Counter of published jobs, lets workers notice a new one */
+    int busy; /**< Flag indicating that a job is running */
+} ThreadPool;
+
+/**
+ * @brief Structure representing a rectangle by its corners, both inclusive.
+ */
+typedef struct Rect {
+    int x1; /**< The x-coordinate of the top-left corner */
+    int y1; /**< The y-coordinate of the top-left corner */
+    int x2; /**< The x-coordinate of the bottom-right corner */
+    int y2; /**< The y-coordinate of the bottom-right corner */
+} Rect;
+
+/**
+ * @brief Structure representing the area moved by the 'copy' function, clipped to the image.
+ */
+typedef struct CopyArea {
+    Rect source; /**< The pixels copied, empty if x1 > x2 or y1 > y2 */
+    int offset_x; /**< The distance the pixels move to the right */
+    int offset_y; /**< The distance the pixels move down */
+} CopyArea;
+
+/**
+ * @brief Structure representing a growable list of rectangles.
+ */
+typedef struct RectList {
+    Rect* rects; /**< Array of rectangles */
+    size_t count; /**< Number of rectangles in the list */
+    size_t capacity; /**< Number of rectangles the array can hold */
+} RectList;
+
+/* Number of rows in one bin of a BorderBatch. */
+#define BORDER_BIN_ROWS 64
+
+/**
+ * @brief Structure holding many rectangle borders of one color, binned by rows so they can be drawn row by row.
+ */
+typedef struct BorderBatch {
+    Rect* binned; /**< Copies of the rectangles of every bin, sorted by their left edge */
+    size_t* bin_offsets; /**< Start of every bin in binned, with one more entry for the end of the last bin */
+    int thickness; /**< Thickness of the borders */
+    const png_byte* color; /**< Pixel of the border color, in the format of the image */
+} BorderBatch;
+
+/**
+ * @brief Structure representing a bitmap with one bit per pixel of an image.
+ */
+typedef struct PixelBitmap {
+    uint64_t* bits; /**< Rows of words, bit x % 64 of word x / 64 stands for pixel x */
+    size_t words_per_row; /**< Number of words in one row */
+    int width; /**< Width of the bitmap in bits */
+    int height; /**< Height of the bitmap in rows */
+} PixelBitmap;
+
+/**
+ * @brief Structure holding the prepared parameters of an ornament drawn row by row.
+ */
+typedef struct OrnamentContext {
+    png_byte color[MAX_PIXEL_BYTES]; /**< Pixel of the ornament color, in the format of the image */
+    int thickness; /**< Thickness of the ornament */
+    int count; /**< Number of repetitions of the pattern */
+    Rect* rects; /**< Borders of the 'rectangle' pattern */
+    int rect_count; /**< Number of borders of the 'rectangle' pattern */
+    int radius_x; /**< Radius of the upper and lower semicircles of the 'semicircles' pattern */
+    int radius_y; /**< Radius of the left and right semicircles of the 'semicircles' pattern */
+} OrnamentContext;
+
+/**
+ * @brief Structure holding the prepared colors of the 'color_replace' function.
+ */
+typedef struct ColorReplaceContext {
+    png_byte old_color[MAX_PIXEL_BYTES]; /**< Pixel of the color to be replaced, in the format of the image */
+    png_byte new_color[MAX_PIXEL_BYTES]; /**< Pixel of the color to replace with, in the format of the image */
+    ColorReplaceKernel kernel; /**< Kernel picked for the pixel format and the processor at run time */
+} ColorReplaceContext;
+
+/**
+ * @brief Structure representing a hash table of old-to-new color pairs used by the '--color_map' option.
+ */
+typedef struct ColorMap {
+    uint64_t* keys; /**< Color channels of the old colors packed big-endian, empty slots hold all ones */
+    uint64_t* values; /**< Color channels of the new colors packed the same way, stored in the same slots as their keys */
+    size_t capacity; /**< Number of slots, always a power of two */
+    size_t count; /**< Number of pairs stored */
+    int shift; /**< Right shift turning a 64-bit hash into a slot index */
+    const struct PixelFormat* format; /**< Format of the pixels the colors were packed from */
+    RowFunction row_function; /**< Row function specialized for format */
+} ColorMap;
+
+/**
+ * @brief Functions that can be applied to an image.
+ */
+typedef enum OperationType {
+    OPERATION_COPY, /**< The 'copy' function */
+    OPERATION_COLOR_REPLACE, /**< The 'color_replace' function */
+    OPERATION_ORNAMENT, /**< The 'ornament' function */
+    OPERATION_FILLED_RECTS /**< The 'filled_rects' function */
+} OperationType;
+
+/**
+ * @brief Structure representing one function of the pipeline with its own options.
+ */
+typedef struct Operation {
+    OperationType type; /**< The function to be executed */
     int flag_left_up; /**< Flag indicating if the top-left coordinate of the source area has been specified */
     int flag_right_down; /**< Flag indicating if the bottom-right coordinate of the source area has been specified */
     int flag_dest_left_up; /**< Flag indicating if the top-left coordinate of the destination area has been specified */
@@ -54,7 +269,7 @@ typedef struct {
     int flag_thickness; /**< Flag indicating if the thickness for ornamentation or filled rectangles has been specified */
     int flag_count; /**< Flag indicating if the count for ornamentation has been specified */
     int flag_border_color; /**< Flag indicating if the border color for filled rectangles has been specified */
-    int flag_info; /**< Flag indicating if detailed information about the input PNG file should be printed */
+    int flag_color_map; /**< Flag indicating if the file of color pairs for color replacement has been specified */
     char* left_up_value; /**< Value of the top-left coordinate of the source area */
     char* right_down_value; /**< Value of the bottom-right coordinate of the source area */
     char* dest_left_up_value; /**< Value of the top-left coordinate of the destination area */
@@ -65,6 +280,268 @@ typedef struct {
     char* thickness_value; /**< Value of the thickness for ornamentation or filled rectangles */
     char* count_value; /**< Value of the count for ornamentation */
     char* border_color_value; /**< Value of the border color for filled rectangles */
+    char* color_map_value; /**< Filename of the color pairs for color replacement */
+} Operation;
+
+/**
+ * @brief Structure representing a function of the pipeline that works on every row on its own.
+ */
+typedef struct PipelineStage {
+    Operation* operation; /**< The function the stage was prepared from */
+    RowFunction function; /**< Row function of the stage */
+    void* context; /**< Context of function, taken from the arena of the job */
+} PipelineStage;
+
+/**
+ * @brief Structure representing consecutive row-local functions fused into a single pass over the rows.
+ */
+typedef struct Pipeline {
+    PipelineStage* stages; /**< Stages in the order they are applied to every row */
+    int stage_count; /**< Number of stages */
+} Pipeline;
+
+/**
+ * @brief Structure representing the functions applied to an image streamed from the input file to the output file.
+ */
+typedef struct StreamTask {
+    Operation* operations; /**< The functions, in the order they were given */
+    int operation_count; /**< Number of functions */
+    Pipeline pipeline; /**< Every row-local function, applied to the rows no other function reads or writes */
+} StreamTask;
+
+/**
+ * @brief Stages of a run timed by --profile.
+ */
+typedef enum ProfileStage {
+    PROFILE_READ, /**< Reading the input file, or only its header for --info */
+    PROFILE_OPERATIONS, /**< Applying the functions to the image in memory */
+    PROFILE_WRITE, /**< Writing the output file */
+    PROFILE_STREAM, /**< Streaming the image from the input file to the output file, all three at once */
+    PROFILE_PALETTE, /**< Rewriting the palette of an indexed-color image */
+    PROFILE_STAGE_COUNT /**< Number of stages */
+} ProfileStage;
+
+/**
+ * @brief Structure representing the start of a timed stage.
+ */
+typedef struct ProfileTimer {
+    uint64_t wall_ns; /**< Monotonic time the stage started at, in nanoseconds */
+    uint64_t cpu_ns; /**< CPU time of the process, all threads together, the stage started at, in nanoseconds */
+} ProfileTimer;
+
+/**
+ * @brief Structure representing the totals collected by --profile, updated atomically from any thread.
+ */
+typedef struct ProfileCounters {
+    uint64_t wall_ns[PROFILE_STAGE_COUNT]; /**< Wall time spent in every stage, in nanoseconds */
+    uint64_t cpu_ns[PROFILE_STAGE_COUNT]; /**< CPU time spent in every stage, in nanoseconds */
+    uint64_t bytes_read; /**< Bytes of PNG data read from input files */
+    uint64_t bytes_written; /**< Bytes written to output files */
+    uint64_t pixels_visited; /**< Pixels of the rows and areas the functions were given */
+    uint64_t pixels_modified; /**< Pixels the functions wrote */
+    uint64_t rects_found; /**< Rectangles found by 'filled_rects' */
+    uint64_t allocations; /**< Allocations of buffers sized by the image or the file */
+    uint64_t arena_bytes; /**< Bytes taken from arenas by all jobs together */
+    uint64_t arena_peak_bytes; /**< Most bytes taken from an arena by one job */
+} ProfileCounters;
+
+/**
+ * @brief Structure representing one block of memory of an arena.
+ */
+typedef struct ArenaBlock {
+    struct ArenaBlock* next; /**< The block added after this one, NULL for the last one */
+    size_t size; /**< Size of data in bytes */
+    size_t used; /**< Number of bytes of data handed out */
+    unsigned char data[]; /**< The memory handed out */
+} ArenaBlock;
+
+/**
+ * @brief Structure representing an arena: memory handed out in order and given back all at once at the end of a job.
+ */
+typedef struct Arena {
+    ArenaBlock* first; /**< The first block, kept between jobs, NULL before the first allocation */
+    ArenaBlock* current; /**< The block allocations are taken from, always the last one */
+    size_t used; /**< Bytes taken by the current job */
+    size_t peak; /**< Most bytes taken by one job */
+    size_t total; /**< Bytes taken by all jobs together */
+} Arena;
+
+/**
+ * @brief Structure representing a PNG file being read, held in memory as a whole.
+ */
+typedef struct PngInput {
+    png_const_bytep data; /**< Contents of the file, mapped for regular files and read into memory for '-' (stdin) */
+    size_t size; /**< Size of the file in bytes */
+    size_t position; /**< Offset of the next byte libpng reads */
+    int mapped; /**< Flag indicating that data is a memory mapping rather than an allocated buffer */
+} PngInput;
+
+/**
+ * @brief Structure representing a chunk of a PNG file held in memory.
+ */
+typedef struct PngChunk {
+    size_t position; /**< Offset of the chunk in the file, pointing at its length field */
+    png_uint_32 length; /**< Size of the data of the chunk in bytes */
+    png_const_bytep type; /**< The 4 bytes of the chunk type */
+    png_const_bytep data; /**< The data of the chunk, followed by its CRC */
+} PngChunk;
+
+/**
+ * @brief Structure representing a PNG file being written through a large buffer.
+ */
+typedef struct PngOutput {
+    int fd; /**< File descriptor the data is written to */
+    png_bytep buffer; /**< Data not written to fd yet */
+    size_t capacity; /**< Size of buffer in bytes */
+    size_t filled; /**< Number of bytes in buffer */
+    char* file_name; /**< Name of the file the output ends up in, NULL for '-' (stdout) */
+    char* target_name; /**< Path an existing file_name resolves to, links followed, NULL if file_name does not exist yet */
+    char* temporary_name; /**< Name of the file written instead, renamed to target_name when closed, NULL if file_name is written directly */
+    int created; /**< 1 if file_name was created by the output and is removed again when it is dropped, 0 otherwise */
+} PngOutput;
+
+/**
+ * @brief Structure representing the settings of the PNG encoder, a negative value or 0 buffer_size keeps the libpng default.
+ */
+typedef struct EncoderSettings {
+    int compression_level; /**< zlib compression level from 0 to 9 */
+    int strategy; /**< zlib strategy (Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE or Z_FIXED) */
+    int filters; /**< Mask of the PNG_FILTER_* row filters the encoder may choose from */
+    size_t buffer_size; /**< Size in bytes of the buffer compressed data is collected in before it is written */
+    size_t output_buffer_size; /**< Size in bytes of the buffer the output file is written through */
+} EncoderSettings;
+
+/**
+ * @brief Structure representing one strip of rows filtered and compressed on its own by the parallel encoder.
+ */
+typedef struct EncodedStrip {
+    png_bytep data; /**< Raw deflate data of the strip, ending on a byte boundary */
+    size_t size; /**< Size of data in bytes */
+    uLong adler; /**< Adler-32 checksum of the filtered rows of the strip */
+    size_t raw_size; /**< Size in bytes of the filtered rows of the strip */
+    int failed; /**< Flag indicating that zlib failed on the strip */
+} EncodedStrip;
+
+/**
+ * @brief Structure holding the state of the parallel encoder shared by the tasks compressing the strips.
+ */
+typedef struct ParallelEncoder {
+    Png* image; /**< The image being encoded */
+    size_t row_bytes; /**< Number of bytes of pixel data in one row */
+    int bytes_per_pixel; /**< Distance in bytes between a byte and the matching byte of the previous pixel, as filters use it */
+    int compression_level; /**< zlib compression level */
+    int strategy; /**< zlib strategy */
+    int filters; /**< Mask of the PNG_FILTER_* row filters to choose from */
+    int strip_count; /**< Number of strips */
+    EncodedStrip* strips; /**< The strips from the top of the image to the bottom */
+} ParallelEncoder;
+
+/**
+ * @brief Structure representing options provided to the program.
+ */
+typedef struct {
+    char* input_file; /**< Filename of the input PNG file */
+    char* output_file; /**< Filename of the output PNG file */
+    int flag_help; /**< Flag indicating if the help message should be displayed */
+    int flag_input; /**< Flag indicating if the input file has been specified */
+    int flag_output; /**< Flag indicating if the output file has been specified */
+    int flag_info; /**< Flag indicating if detailed information about the input PNG file should be printed */
+    int flag_threads; /**< Flag indicating if the number of threads has been specified */
+    int flag_batch; /**< Flag indicating if a manifest of images has been specified */
+    int flag_memory_limit; /**< Flag indicating if the memory limit has been specified */
+    int flag_profile; /**< Flag indicating if a profile of the run should be printed as JSON */
+    int flag_serve; /**< Flag indicating if requests should be served on a socket */
+    char* threads_value; /**< Value of the number of threads */
+    char* batch_value; /**< Filename of the manifest of images */
+    char* memory_limit_value; /**< Value of the memory limit in MiB */
+    char* serve_value; /**< Filename of the socket requests are served on */
+    int flag_compression_level; /**< Flag indicating if the compression level has been specified */
+    int flag_strategy; /**< Flag indicating if the zlib strategy has been specified */
+    int flag_filters; /**< Flag indicating if the row filters have been specified */
+    int flag_buffer_size; /**< Flag indicating if the size of the compression buffer has been specified */
+    int flag_encode; /**< Flag indicating if an encoder preset has been specified */
+    int flag_output_buffer_size; /**< Flag indicating if the size of the output buffer has been specified */
+    char* compression_level_value; /**< Value of the compression level */
+    char* strategy_value; /**< Value of the zlib strategy */
+    char* filters_value; /**< Comma-separated list of row filters */
+    char* buffer_size_value; /**< Value of the size of the compression buffer */
+    char* encode_value; /**< Name of the encoder preset */
+    char* output_buffer_size_value; /**< Value of the size of the output buffer */
+    EncoderSettings encoder; /**< Settings of the encoder built from the options above */
+    Operation* operations; /**< Functions to be executed, in the order they were given */
+    int operation_count; /**< Number of functions to be executed */
 } Options;
 
+/**
+ * @brief Structure representing one line of a '--batch' manifest.
+ */
+typedef struct BatchJob {
+    Options options; /**< Options parsed from the line, the strings point into arguments */
+    char* line; /**< The manifest line, cut into the tokens in place */
+    char** arguments; /**< Tokens of the line, the first one standing for the program name */
+    int line_number; /**< Number of the line in the manifest */
+    off_t size; /**< Size of the input file in bytes, used to start the largest images first */
+} BatchJob;
+
+/**
+ * @brief Structure representing the jobs given to one worker, which other workers can steal from.
+ */
+typedef struct JobQueue {
+    BatchJob** jobs; /**< Jobs from the largest to the smallest input */
+    int head; /**< Index of the next job the owner takes */
+    int tail; /**< Index after the last job not taken yet, thieves take from here */
+    pthread_mutex_t mutex; /**< Mutex protecting head and tail */
+} JobQueue;
+
+/**
+ * @brief Structure holding the state of a '--batch' run shared by its workers.
+ */
+typedef struct Batch {
+    char* manifest; /**< Filename of the manifest */
+    BatchJob* jobs; /**< All jobs of the manifest in the order of its lines */
+    int job_count; /**< Number of jobs */
+    JobQueue* queues; /**< One queue per worker */
+    int queue_count; /**< Number of workers */
+    int failed_jobs; /**< Number of jobs that raised an error */
+    pthread_mutex_t mutex; /**< Mutex protecting failed_jobs */
+} Batch;
+
+/**
+ * @brief Structure representing a client connected to the socket of '--serve'.
+ */
+typedef struct ServeConnection {
+    int fd; /**< Socket of the client */
+    int references; /**< Number of holders: the thread reading the requests and every request not answered yet */
+    pthread_mutex_t mutex; /**< Mutex protecting references and keeping replies from interleaving */
+    struct Server* server; /**< The server the requests are queued on */
+} ServeConnection;
+
+/**
+ * @brief Structure representing one request read from a connection of '--serve'.
+ */
+typedef struct ServeRequest {
+    Options options; /**< Options parsed from the request, the strings point into line */
+    char* line; /**< The JSON line of the request, its strings decoded in place */
+    char** arguments; /**< Arguments built from the request, the first one standing for the program name */
+    const char* id; /**< The "id" of the request as it is written in line, NULL if it has none */
+    int id_length; /**< Length of id in bytes */
+    ServeConnection* connection; /**< The connection the reply goes to */
+    uint64_t received_ns; /**< Monotonic time the request was read at, in nanoseconds */
+    struct ServeRequest* next; /**< The request queued after this one */
+} ServeRequest;
+
+/**
+ * @brief Structure holding the state of a '--serve' run shared by its threads.
+ */
+typedef struct Server {
+    char* socket_path; /**< Filename of the socket */
+    int listen_fd; /**< The listening socket */
+    ServeRequest* head; /**< The oldest request no worker took yet, NULL if there is none */
+    ServeRequest* tail; /**< The newest request no worker took yet */
+    int queued_count; /**< Number of requests from head to tail */
+    int connection_count; /**< Number of connections not closed yet */
+    pthread_mutex_t mutex; /**< Mutex protecting head, tail and the counts */
+    pthread_cond_t request_ready; /**< Signalled when a request is queued */
+} Server;
+
 #endif
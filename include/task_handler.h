@@ -7,14 +7,32 @@ void print_help();
 
 void print_png_info(Png *image);
 
+int palette_task_switcher(Options options);
+
+int stream_task_switcher(Options options);
+
+void run_operation(Operation *operation, Png *image);
+
+void run_operations(Operation *operations, int operation_count, Png *image);
+
 void task_switcher(Options options, Png *image);
 
+void run_task(Options options, Png *image);
+
+void prepare_color_replace(ColorReplaceContext *context, Png *image, char* old_color, char* new_color);
+
+void color_replace_row(Png *image, png_bytep row, int y, void *context);
+
 void color_replace(Png *image, char* old_color, char* new_color);
 
+void color_map_replace(Png *image, char* file_name);
+
 void copy_area(Png *image, char* left_up, char* right_down, char* dest_left_up);
 
 void filled_rects(Png *image, char* string_color, char* string_border_color, char* thickness);
 
+RowFunction prepare_ornament(Png *image, char* pattern, char* string_color, char* thickness, char* count, OrnamentContext *context);
+
 void ornament(Png *image, char* pattern, char* string_color, char* thickness, char* count);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,16 @@
+#ifndef THREAD_HANDLER_H
+#define THREAD_HANDLER_H
+
+#include "structures.h"
+
+void init_thread_pool(int thread_count);
+
+int get_thread_count();
+
+int get_free_thread_count();
+
+void run_parallel(int task_count, TaskFunction function, void *context);
+
+void parallel_rows(Png *image, RowFunction function, void *context);
+
+#endif
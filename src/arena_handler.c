@@ -0,0 +1,140 @@
+#include "errors.h"
+#include "structures.h"
+#include "error_handler.h"
+#include "profile_handler.h"
+
+/* Size in bytes of a regular block, larger allocations get a block of their own. */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/* Alignment in bytes of every allocation, enough for any scalar type. */
+#define ARENA_ALIGNMENT 16
+
+/* Arena the current thread allocates from, NULL for the one of the thread below. */
+static __thread Arena *current_arena = NULL;
+
+/* Arena used while no job set one, it lives as long as its thread. */
+static __thread Arena thread_arena;
+
+/**
+ * @brief Sets the arena the current thread allocates from with arena_alloc.
+ *
+ * @param arena A pointer to the Arena structure, or NULL to go back to the arena of the thread.
+ *
+ * This function does not return a value.
+ */
+void use_arena(Arena *arena) {
+    current_arena = arena;
+}
+
+/**
+ * @brief Returns the offset of the next aligned allocation in a block.
+ *
+ * @param block A pointer to the ArenaBlock structure.
+ *
+ * @return size_t The offset from the start of data.
+ */
+static size_t aligned_offset(ArenaBlock *block) {
+    uintptr_t address = (uintptr_t)(block->data + block->used);
+    return block->used + ((ARENA_ALIGNMENT - address % ARENA_ALIGNMENT) % ARENA_ALIGNMENT);
+}
+
+/**
+ * @brief Adds a block after the last one of an arena.
+ *
+ * @param arena A pointer to the Arena structure.
+ * @param size The number of bytes the block has to hold besides the alignment.
+ *
+ * @return ArenaBlock* The new block, which becomes the current one.
+ */
+static ArenaBlock* add_arena_block(Arena *arena, size_t size) {
+    size_t block_size = (size + ARENA_ALIGNMENT > ARENA_BLOCK_SIZE) ? size + ARENA_ALIGNMENT : ARENA_BLOCK_SIZE;
+    ArenaBlock *block = (size < SIZE_MAX - ARENA_ALIGNMENT - sizeof(ArenaBlock)) ? malloc(sizeof(ArenaBlock) + block_size) : NULL;
+    if (block == NULL) {
+        printf("Error: Can not allocate memory for arena\n");
+        raise_error(ERR_MEMORY_ALLOCATION_FAILURE);
+    }
+    block->next = NULL;
+    block->size = block_size;
+    block->used = 0;
+
+    if (arena->current != NULL) {
+        arena->current->next = block;
+    } else {
+        arena->first = block;
+    }
+    arena->current = block;
+    return block;
+}
+
+/**
+ * @brief Allocates memory for the current job from the arena of the current thread.
+ *
+ * @param size The size in bytes.
+ *
+ * @return void* The memory, ARENA_ALIGNMENT-aligned. It is never freed on its own, only with the whole arena.
+ *
+ * @note Raises ERR_MEMORY_ALLOCATION_FAILURE instead of returning NULL.
+ */
+void* arena_alloc(size_t size) {
+    Arena *arena = (current_arena != NULL) ? current_arena : &thread_arena;
+
+    ArenaBlock *block = arena->current;
+    size_t offset = (block != NULL) ? aligned_offset(block) : 0;
+    if (block == NULL || offset > block->size || size > block->size - offset) {
+        block = add_arena_block(arena, size);
+        offset = aligned_offset(block);
+    }
+
+    block->used = offset + size;
+    arena->used += size;
+    return block->data + offset;
+}
+
+/**
+ * @brief Gives back everything allocated from an arena at once, at the end of a job.
+ *
+ * @param arena A pointer to the Arena structure.
+ *
+ * This function does not return a value.
+ *
+ * @note The bytes of the job are added to the totals of the arena and of --profile. A regular first block is kept for the next job,
+ *       so jobs fitting in it do not call malloc at all.
+ */
+void reset_arena(Arena *arena) {
+    arena->total += arena->used;
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+    PROFILE_COUNT(arena_bytes, arena->used);
+    PROFILE_MAX(arena_peak_bytes, arena->used);
+    arena->used = 0;
+
+    ArenaBlock *kept = (arena->first != NULL && arena->first->size == ARENA_BLOCK_SIZE) ? arena->first : NULL;
+    ArenaBlock *block = (kept != NULL) ? kept->next : arena->first;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    if (kept != NULL) {
+        kept->next = NULL;
+        kept->used = 0;
+    }
+    arena->first = kept;
+    arena->current = kept;
+}
+
+/**
+ * @brief Gives back everything allocated from an arena and the arena's own memory.
+ *
+ * @param arena A pointer to the Arena structure, which can be used again afterwards.
+ *
+ * This function does not return a value.
+ */
+void free_arena(Arena *arena) {
+    reset_arena(arena);
+    free(arena->first);
+    arena->first = NULL;
+    arena->current = NULL;
+}
@@ -0,0 +1,321 @@
+#include "errors.h"
+#include "structures.h"
+#include "error_handler.h"
+#include "file_handler.h"
+#include "preparation_handler.h"
+#include "task_handler.h"
+#include "thread_handler.h"
+#include "arena_handler.h"
+
+/**
+ * @brief Splits a manifest line into tokens the way a shell without quoting would.
+ * 
+ * @param line The line, cut into tokens in place.
+ * @param arguments A pointer where the array of tokens is stored, the first entry stands for the program name.
+ * 
+ * @return int The number of entries in the array, 1 if the line holds no tokens.
+ */
+static int split_line(char *line, char ***arguments) {
+    int count = 1;
+    int capacity = 16;
+    char **tokens = malloc(sizeof(char*) * capacity);
+    if (tokens == NULL) {
+        printf("Error: Can not allocate memory for manifest line\n");
+        exit(ERR_MEMORY_ALLOCATION_FAILURE);
+    }
+    tokens[0] = "cw";
+
+    /* Cutting off comments */
+    char *comment = strchr(line, '#');
+    if (comment) {
+        *comment = '\0';
+    }
+
+    char *save;
+    for (char *token = strtok_r(line, " \t\r\n", &save); token != NULL; token = strtok_r(NULL, " \t\r\n", &save)) {
+        /* One slot is kept for the terminating NULL */
+        if (count + 1 >= capacity) {
+            capacity *= 2;
+            tokens = realloc(tokens, sizeof(char*) * capacity);
+            if (tokens == NULL) {
+                printf("Error: Can not allocate memory for manifest line\n");
+                exit(ERR_MEMORY_ALLOCATION_FAILURE);
+            }
+        }
+        tokens[count++] = token;
+    }
+    tokens[count] = NULL;
+
+    *arguments = tokens;
+    return count;
+}
+
+/**
+ * @brief Reads the manifest and parses every line into a job.
+ * 
+ * @param batch A pointer to the Batch structure whose jobs are filled.
+ * 
+ * This function does not return a value.
+ * 
+ * @note Every line is checked like the command line of a single run, so a wrong line stops the batch before any image is processed.
+ */
+static void read_manifest(Batch *batch) {
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_number = 0;
+    int capacity = 0;
+
+    FILE *fp = fopen(batch->manifest, "r");
+    if (!fp) {
+        printf("Error: Can not read file %s\n", batch->manifest);
+        exit(ERR_FILE_NOT_FOUND);
+    }
+
+    while (getline(&line, &line_size, fp) != -1) {
+        line_number++;
+
+        char **arguments;
+        int argument_count = split_line(line, &arguments);
+        if (argument_count == 1) {
+            free(arguments);
+            continue;
+        }
+
+        if (batch->job_count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            batch->jobs = realloc(batch->jobs, sizeof(BatchJob) * capacity);
+            if (batch->jobs == NULL) {
+                printf("Error: Can not allocate memory for batch jobs\n");
+                exit(ERR_MEMORY_ALLOCATION_FAILURE);
+            }
+        }
+        BatchJob *job = &batch->jobs[batch->job_count++];
+
+        /* Same defaults as a single run, getopt starts over for every line */
+        job->options = (Options){NULL};
+        job->options.output_file = "out.png";
+        job->line = line;
+        job->arguments = arguments;
+        job->line_number = line_number;
+        optind = 0;
+        handle_arguments(argument_count, arguments, &job->options);
+        if (job->options.flag_help || job->options.flag_batch || job->options.flag_threads || job->options.flag_memory_limit || job->options.flag_profile) {
+            printf("Error: --help, --batch, --threads, --memory_limit and --profile cannot be used on line %d of %s\n", line_number, batch->manifest);
+            exit(ERR_INSUFFICIENT_ARGUMENTS);
+        }
+        if (strcmp(job->options.input_file, "-") == 0 || strcmp(job->options.output_file, "-") == 0) {
+            printf("Error: Standard input and output cannot be used on line %d of %s\n", line_number, batch->manifest);
+            exit(ERR_INSUFFICIENT_ARGUMENTS);
+        }
+
+        /* Unreadable inputs get size 0, their jobs fail when they run */
+        struct stat input_stat;
+        job->size = stat(job->options.input_file, &input_stat) == 0 ? input_stat.st_size : 0;
+
+        /* Tokens point into the line, so it is kept for the job */
+        line = NULL;
+        line_size = 0;
+    }
+
+    free(line);
+    fclose(fp);
+}
+
+/**
+ * @brief Compares two jobs by the size of their input, the largest first.
+ * 
+ * @param first A pointer to a pointer to the first BatchJob.
+ * @param second A pointer to a pointer to the second BatchJob.
+ * 
+ * @return int A negative value if the first job is larger, a positive one if it is smaller, 0 otherwise.
+ */
+static int compare_jobs(const void *first, const void *second) {
+    const BatchJob *a = *(BatchJob* const*)first;
+    const BatchJob *b = *(BatchJob* const*)second;
+    if (a->size != b->size) {
+        return a->size > b->size ? -1 : 1;
+    }
+    return a->line_number - b->line_number;
+}
+
+/**
+ * @brief Deals the jobs to one queue per worker, largest first.
+ * 
+ * @param batch A pointer to the Batch structure whose queues are filled.
+ * @param worker_count The number of workers.
+ * 
+ * This function does not return a value.
+ * 
+ * @note Dealing the sorted jobs round-robin gives every worker a similar share of bytes, stealing evens out the rest.
+ */
+static void deal_jobs(Batch *batch, int worker_count) {
+    BatchJob **order = malloc(sizeof(BatchJob*) * batch->job_count);
+    batch->queues = malloc(sizeof(JobQueue) * worker_count);
+    if (order == NULL || batch->queues == NULL) {
+        printf("Error: Can not allocate memory for batch queues\n");
+        exit(ERR_MEMORY_ALLOCATION_FAILURE);
+    }
+    batch->queue_count = worker_count;
+
+    for (int i = 0; i < batch->job_count; i++) {
+        order[i] = &batch->jobs[i];
+    }
+    qsort(order, batch->job_count, sizeof(BatchJob*), compare_jobs);
+
+    for (int i = 0; i < worker_count; i++) {
+        JobQueue *queue = &batch->queues[i];
+        queue->jobs = malloc(sizeof(BatchJob*) * (batch->job_count / worker_count + 1));
+        if (queue->jobs == NULL) {
+            printf("Error: Can not allocate memory for batch queues\n");
+            exit(ERR_MEMORY_ALLOCATION_FAILURE);
+        }
+        queue->head = 0;
+        queue->tail = 0;
+        pthread_mutex_init(&queue->mutex, NULL);
+    }
+    for (int i = 0; i < batch->job_count; i++) {
+        JobQueue *queue = &batch->queues[i % worker_count];
+        queue->jobs[queue->tail++] = order[i];
+    }
+
+    free(order);
+}
+
+/**
+ * @brief Takes the next job of a worker, stealing from the other queues when its own one is empty.
+ * 
+ * @param batch A pointer to the Batch structure.
+ * @param worker The index of the worker.
+ * 
+ * @return BatchJob* The job to run, NULL if no jobs are left.
+ * 
+ * @note The owner takes the largest job of its queue, a thief takes the smallest one, so they rarely meet.
+ */
+static BatchJob* take_job(Batch *batch, int worker) {
+    BatchJob *job = NULL;
+
+    JobQueue *own = &batch->queues[worker];
+    pthread_mutex_lock(&own->mutex);
+    if (own->head < own->tail) {
+        job = own->jobs[own->head++];
+    }
+    pthread_mutex_unlock(&own->mutex);
+
+    for (int i = 1; i < batch->queue_count && job == NULL; i++) {
+        JobQueue *victim = &batch->queues[(worker + i) % batch->queue_count];
+        pthread_mutex_lock(&victim->mutex);
+        if (victim->head < victim->tail) {
+            job = victim->jobs[--victim->tail];
+        }
+        pthread_mutex_unlock(&victim->mutex);
+    }
+
+    return job;
+}
+
+/**
+ * @brief Runs one job, turning the errors it raises into a return value.
+ * 
+ * @param options Options structure of the job.
+ * @param image A pointer to the Png structure of the worker, its buffers are reused between jobs.
+ * 
+ * @return int 0 if the job succeeded, the error code it raised otherwise.
+ * 
+ * @note Used by the workers of --batch and --serve.
+ */
+int run_job(Options options, Png *image) {
+    jmp_buf recovery;
+
+    int code = setjmp(recovery);
+    if (code != 0) {
+        set_error_recovery(NULL);
+        /* The failed read may have left its libpng structures behind */
+        if (image->png_ptr != NULL) {
+            png_destroy_read_struct(&image->png_ptr, &image->info_ptr, NULL);
+        }
+        return code;
+    }
+
+    set_error_recovery(&recovery);
+    run_task(options, image);
+    set_error_recovery(NULL);
+    return 0;
+}
+
+/**
+ * @brief Main loop of a batch worker: runs jobs until none are left.
+ * 
+ * @param index The index of the worker.
+ * @param context A pointer to the Batch structure.
+ * 
+ * This function does not return a value.
+ */
+static void batch_worker(int index, void *context) {
+    Batch *batch = context;
+    Png image = {0};
+    Arena arena = {0};
+    BatchJob *job;
+
+    /* Small allocations of a job are given back at once after it, failed or not */
+    use_arena(&arena);
+    while ((job = take_job(batch, index)) != NULL) {
+        if (run_job(job->options, &image) != 0) {
+            printf("Error: Job on line %d of %s failed\n", job->line_number, batch->manifest);
+            pthread_mutex_lock(&batch->mutex);
+            batch->failed_jobs++;
+            pthread_mutex_unlock(&batch->mutex);
+        }
+        reset_arena(&arena);
+    }
+    use_arena(NULL);
+
+    free_arena(&arena);
+    free_png_pixels(&image);
+}
+
+/**
+ * @brief Processes every image listed in a manifest within this process.
+ * 
+ * @param manifest A string representing the file name/path of the manifest.
+ * 
+ * @return int The exit status of the program: 0 if every job succeeded, ERR_BATCH_JOB_FAILURE otherwise.
+ * 
+ * @note Every non-empty line of the manifest holds the options of one run, for example "--color_replace --old_color 255.0.0 --new_color 0.0.255 -o out.png in.png".
+ *       Everything after '#' is a comment. The images are spread over the threads given by '--threads', each thread processes whole images.
+ */
+int run_batch(char* manifest) {
+    Batch batch = {0};
+    batch.manifest = manifest;
+    pthread_mutex_init(&batch.mutex, NULL);
+
+    read_manifest(&batch);
+
+    int worker_count = get_thread_count();
+    if (worker_count > batch.job_count) {
+        worker_count = batch.job_count > 0 ? batch.job_count : 1;
+    }
+    deal_jobs(&batch, worker_count);
+
+    /* Workers take the whole pool, so the rows of each image are processed on its worker only */
+    run_parallel(worker_count, batch_worker, &batch);
+
+    /* Clean up */
+    for (int i = 0; i < batch.queue_count; i++) {
+        pthread_mutex_destroy(&batch.queues[i].mutex);
+        free(batch.queues[i].jobs);
+    }
+    free(batch.queues);
+    for (int i = 0; i < batch.job_count; i++) {
+        free(batch.jobs[i].line);
+        free(batch.jobs[i].arguments);
+        free(batch.jobs[i].options.operations);
+    }
+    free(batch.jobs);
+    pthread_mutex_destroy(&batch.mutex);
+
+    if (batch.failed_jobs > 0) {
+        printf("Error: %d of %d jobs failed\n", batch.failed_jobs, batch.job_count);
+        return ERR_BATCH_JOB_FAILURE;
+    }
+    return 0;
+}
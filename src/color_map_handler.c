@@ -0,0 +1,193 @@
+#include "errors.h"
+#include "structures.h"
+#include "error_handler.h"
+#include "arena_handler.h"
+
+/* Key of an empty slot, packed colors take at most 48 bits (16-bit RGB). */
+#define COLOR_MAP_EMPTY UINT64_MAX
+
+/**
+ * @brief Packs the color channels of a pixel into a single key.
+ * 
+ * @param format Pointer to the PixelFormat of the pixel.
+ * @param pixel Pointer to the pixel.
+ * @return uint64_t The bytes of the color channels, the first one the most significant.
+ */
+uint64_t pack_color(const PixelFormat *format, const png_byte *pixel) {
+    uint64_t key = 0;
+    for (int i = 0; i < format->color_bytes; i++) {
+        key = (key << 8) | pixel[i];
+    }
+    return key;
+}
+
+/**
+ * @brief Computes the first slot probed for a key.
+ * 
+ * @param map Pointer to the ColorMap structure.
+ * @param key The packed color.
+ * @return size_t The index of the slot.
+ */
+static size_t color_map_slot(const ColorMap *map, uint64_t key) {
+    /* Multiplicative hashing, the top bits of the product are the best mixed */
+    return (size_t)((key * 0x9E3779B97F4A7C15ull) >> map->shift);
+}
+
+/**
+ * @brief Finds the new color of an old one.
+ * 
+ * @param map Pointer to the ColorMap structure.
+ * @param key The packed old color.
+ * @return uint64_t The packed new color, COLOR_MAP_EMPTY if the color is not in the map.
+ */
+static uint64_t color_map_lookup(const ColorMap *map, uint64_t key) {
+    size_t mask = map->capacity - 1;
+    for (size_t slot = color_map_slot(map, key); map->keys[slot] != COLOR_MAP_EMPTY; slot = (slot + 1) & mask) {
+        if (map->keys[slot] == key) {
+            return map->values[slot];
+        }
+    }
+    return COLOR_MAP_EMPTY;
+}
+
+/**
+ * @brief Defines the row function of the color map for one pixel format.
+ * 
+ * @param NAME The suffix of the function name.
+ * @param PIXEL_BYTES The size of a pixel in bytes.
+ * @param COLOR_BYTES The size in bytes of the color channels at the start of a pixel.
+ * 
+ * @note Every pixel is looked up once, so the mapped colors are not mapped again.
+ *       Neighbouring pixels usually share a color, so the last lookup is remembered.
+ */
+#define DEFINE_COLOR_MAP_ROW(NAME, PIXEL_BYTES, COLOR_BYTES) \
+static void color_map_row_##NAME(Png *image, png_bytep row, int y, void *context) { \
+    const ColorMap *map = context; \
+    uint64_t last_color = COLOR_MAP_EMPTY; \
+    uint64_t last_result = COLOR_MAP_EMPTY; \
+    (void)y; \
+    for (int x = 0; x < image->width; x++, row += PIXEL_BYTES) { \
+        uint64_t color = 0; \
+        for (int i = 0; i < COLOR_BYTES; i++) { \
+            color = (color << 8) | row[i]; \
+        } \
+        if (color != last_color) { \
+            last_color = color; \
+            last_result = color_map_lookup(map, color); \
+        } \
+        if (last_result != COLOR_MAP_EMPTY) { \
+            for (int i = 0; i < COLOR_BYTES; i++) { \
+                row[i] = (last_result >> (8 * (COLOR_BYTES - 1 - i))) & 0xFF; \
+            } \
+        } \
+    } \
+}
+
+DEFINE_COLOR_MAP_ROW(1, 1, 1)
+DEFINE_COLOR_MAP_ROW(2, 2, 1)
+DEFINE_COLOR_MAP_ROW(3, 3, 3)
+DEFINE_COLOR_MAP_ROW(4, 4, 3)
+DEFINE_COLOR_MAP_ROW(2_wide, 2, 2)
+DEFINE_COLOR_MAP_ROW(4_wide, 4, 2)
+DEFINE_COLOR_MAP_ROW(6, 6, 6)
+DEFINE_COLOR_MAP_ROW(8, 8, 6)
+
+/**
+ * @brief Picks the row function of the color map for a pixel format.
+ * 
+ * @param format Pointer to the PixelFormat of the image.
+ * @return RowFunction The function specialized for the sizes of the pixel and its color channels.
+ */
+static RowFunction select_color_map_row(const PixelFormat *format) {
+    switch (format->pixel_bytes) {
+        case 1:
+            return color_map_row_1;
+        case 2:
+            return (format->color_bytes == 1) ? color_map_row_2 : color_map_row_2_wide;
+        case 3:
+            return color_map_row_3;
+        case 4:
+            return (format->color_bytes == 3) ? color_map_row_4 : color_map_row_4_wide;
+        case 6:
+            return color_map_row_6;
+        default:
+            return color_map_row_8;
+    }
+}
+
+/**
+ * @brief Creates an empty color map able to hold the given number of pairs.
+ * 
+ * @param expected_count The number of old-to-new pairs that will be inserted.
+ * @param format Pointer to the PixelFormat of the image the map is applied to.
+ * @return ColorMap* Pointer to the created ColorMap structure, taken from the arena of the job with its table.
+ * 
+ * @note The table is kept at most half full, so lookups of absent colors stop after a probe or two.
+ */
+ColorMap* create_color_map(size_t expected_count, const PixelFormat *format) {
+    ColorMap *map = arena_alloc(sizeof(ColorMap));
+
+    /* Power of two capacity of at least twice the number of pairs */
+    int bits = 4;
+    while (((size_t)1 << bits) < expected_count * 2 && bits < 25) {
+        bits++;
+    }
+    map->capacity = (size_t)1 << bits;
+    map->shift = 64 - bits;
+    map->count = 0;
+    map->format = format;
+    map->row_function = select_color_map_row(format);
+
+    map->keys = arena_alloc(sizeof(uint64_t) * map->capacity);
+    map->values = arena_alloc(sizeof(uint64_t) * map->capacity);
+    for (size_t i = 0; i < map->capacity; i++) {
+        map->keys[i] = COLOR_MAP_EMPTY;
+    }
+
+    return map;
+}
+
+/**
+ * @brief Adds an old-to-new pair to the color map.
+ * 
+ * @param map Pointer to the ColorMap structure.
+ * @param old_color The color to be replaced, packed with pack_color.
+ * @param new_color The color to replace with, packed with pack_color.
+ * @return int 1 if the pair was added, 0 if the old color is already in the map, -1 if the map is full.
+ */
+int color_map_insert(ColorMap *map, uint64_t old_color, uint64_t new_color) {
+    if (map->count * 2 >= map->capacity) {
+        return -1;
+    }
+
+    size_t mask = map->capacity - 1;
+    for (size_t slot = color_map_slot(map, old_color); ; slot = (slot + 1) & mask) {
+        if (map->keys[slot] == old_color) {
+            return 0;
+        }
+        if (map->keys[slot] == COLOR_MAP_EMPTY) {
+            map->keys[slot] = old_color;
+            map->values[slot] = new_color;
+            map->count++;
+            return 1;
+        }
+    }
+}
+
+/**
+ * @brief Replaces every pixel whose color is in the map with its mapped color in a single row.
+ * 
+ * @param image A pointer to the Png structure the row belongs to.
+ * @param row A pointer to the pixel data of the row.
+ * @param y The index of the row in the image.
+ * @param context A pointer to the ColorMap structure.
+ * 
+ * This function does not return a value.
+ * 
+ * @note Every pixel is looked up once, so the mapped colors are not mapped again.
+ *       The work is done by the row function picked for the pixel format when the map was created.
+ */
+void color_map_row(Png *image, png_bytep row, int y, void *context) {
+    const ColorMap *map = context;
+    map->row_function(image, row, y, context);
+}
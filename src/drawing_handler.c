@@ -1,17 +1,112 @@
 #include "errors.h"
 #include "structures.h"
+#include "error_handler.h"
 #include "preparation_handler.h"
+#include "thread_handler.h"
+#include "profile_handler.h"
+#include "arena_handler.h"
 
 /**
- * @brief Draws a single pixel with the specified color values.
+ * @brief Draws a single pixel with the specified color.
  * 
+ * @param image Pointer to the Png structure representing the image.
  * @param ptr Pointer to the pixel in the image.
- * @param color_values Array containing the RGB values of the pixel color.
+ * @param color Pixel of the color, in the format of the image.
+ * 
+ * @note The pixel is not counted for --profile, callers add up their pixels and count them once per row.
  */
-void draw_pixel(png_bytep ptr, int* color_values) {
-    ptr[0] = color_values[0];
-    ptr[1] = color_values[1];
-    ptr[2] = color_values[2];
+void draw_pixel(Png *image, png_bytep ptr, const png_byte* color) {
+    memcpy(ptr, color, image->pixel_bytes);
+}
+
+/**
+ * @brief Fills a horizontal span of a row with the specified color.
+ * 
+ * @param image Pointer to the Png structure representing the image.
+ * @param row Pointer to the pixel data of the row.
+ * @param x_begin The first pixel of the span.
+ * @param x_end The pixel after the last one of the span.
+ * @param color Pixel of the color, in the format of the image.
+ * 
+ * @note The first pixel is drawn once, then the filled part is copied onto the rest, doubling every time,
+ *       so the span is filled the same way whatever the size of a pixel.
+ */
+void fill_span(Png *image, png_bytep row, int x_begin, int x_end, const png_byte* color) {
+    if (x_begin >= x_end) {
+        return;
+    }
+    png_bytep start = &(row[(size_t)x_begin * image->pixel_bytes]);
+    size_t bytes = (size_t)(x_end - x_begin) * image->pixel_bytes;
+    size_t filled = image->pixel_bytes;
+    PROFILE_COUNT(pixels_modified, x_end - x_begin);
+    memcpy(start, color, image->pixel_bytes);
+    while (filled < bytes) {
+        size_t chunk = (filled < bytes - filled) ? filled : bytes - filled;
+        memcpy(start + filled, start, chunk);
+        filled += chunk;
+    }
+}
+
+/**
+ * @brief Computes the integer square root.
+ * 
+ * @param value A non-negative number.
+ * @return long long The largest integer whose square does not exceed value.
+ */
+long long integer_sqrt(long long value) {
+    long long root = (long long)sqrt((double)value);
+    while (root * root > value) {
+        root--;
+    }
+    while ((root + 1) * (root + 1) <= value) {
+        root++;
+    }
+    return root;
+}
+
+/**
+ * @brief Draws the part of a rectangle border that lies in a single row.
+ * 
+ * @param image Pointer to the Png structure representing the image.
+ * @param row Pointer to the pixel data of the row.
+ * @param y The index of the row in the image.
+ * @param rect The rectangle the border is drawn around.
+ * @param border_color Pixel of the border color, in the format of the image.
+ * @param border_thickness The thickness of the border.
+ */
+void draw_border_row(Png *image, png_bytep row, int y, Rect rect, const png_byte* border_color, int border_thickness) {
+    /* Draw horizontal lines */
+    for (int t = 1; t <= border_thickness; t++) {
+        /* Upper or lower horizontal line */
+        if (y == rect.y1 - t || y == rect.y2 + t) {
+            int x_begin = (rect.x1 - t > 0) ? rect.x1 - t : 0;
+            int x_end = (rect.x2 + t + 1 < image->width) ? rect.x2 + t + 1 : image->width;
+            fill_span(image, row, x_begin, x_end, border_color);
+        }
+    }
+
+    /* Draw vertical lines */
+    int drawn = 0;
+    for (int t = 1; t <= border_thickness; t++) {
+        if (y < rect.y1 - t || y > rect.y2 + t) {
+            continue;
+        }
+
+        /* Left vertical line */
+        int x = rect.x1 - t;
+        if (x >= 0 && x < image->width) {
+            draw_pixel(image, &(row[(size_t)x * image->pixel_bytes]), border_color);
+            drawn++;
+        }
+
+        /* Right vertical line */
+        x = rect.x2 + t;
+        if (x >= 0 && x < image->width) {
+            draw_pixel(image, &(row[(size_t)x * image->pixel_bytes]), border_color);
+            drawn++;
+        }
+    }
+    PROFILE_COUNT(pixels_modified, drawn);
 }
 
 /**
@@ -22,184 +117,412 @@ void draw_pixel(png_bytep ptr, int* color_values) {
  * @param y1 The y-coordinate of the top-left corner of the rectangle.
  * @param x2 The x-coordinate of the bottom-right corner of the rectangle.
  * @param y2 The y-coordinate of the bottom-right corner of the rectangle.
- * @param border_color Array containing the RGB values of the border color.
+ * @param border_color Pixel of the border color, in the format of the image.
  * @param thickness String representing the thickness of the border.
  */
-void draw_border(Png *image, int x1, int y1, int x2, int y2, int* border_color, char* thickness) {
+void draw_border(Png *image, int x1, int y1, int x2, int y2, const png_byte* border_color, char* thickness) {
     /* Convert thickness string to integer */
     int border_thickness = atoi(thickness);
     if (border_thickness <= 0) {
         printf("Error: Border thickness is not a positive integer\n");
-        exit(ERR_INSUFFICIENT_ARGUMENTS);
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
     }
 
-    /* Draw horizontal lines */
-    for (int t = 1; t <= border_thickness; t++) {
-        /* Draw upper horizontal line */
-        int y = y1 - t;
-        if (y >= 0 && y < image->height) {
-            png_bytep row = image->row_pointers[y];
-            for (int x = x1 - t; x <= x2 + t; x++) {
-                if (x >= 0 && x < image->width) {
-                    png_bytep px = &(row[x * 3]);
-                    draw_pixel(px, border_color);
-                }
-            }
+    Rect rect = {x1, y1, x2, y2};
+    int y_begin = ((y1 < y2) ? y1 : y2) - border_thickness;
+    int y_end = ((y1 > y2) ? y1 : y2) + border_thickness;
+    for (int y = (y_begin > 0) ? y_begin : 0; y <= y_end && y < image->height; y++) {
+        draw_border_row(image, image->row_pointers[y], y, rect, border_color, border_thickness);
+    }
+}
+
+/**
+ * @brief Compares two rectangles by their left edge, for qsort.
+ * 
+ * @param a Pointer to the first Rect.
+ * @param b Pointer to the second Rect.
+ * @return int Negative, zero or positive as the first rectangle starts left of, with or right of the second one.
+ */
+static int compare_rects_x(const void *a, const void *b) {
+    const Rect *first = a;
+    const Rect *second = b;
+    return (first->x1 > second->x1) - (first->x1 < second->x1);
+}
+
+/**
+ * @brief Draws the parts of all borders of a batch that lie in a single row.
+ * 
+ * @param image Pointer to the Png structure representing the image.
+ * @param row Pointer to the pixel data of the row.
+ * @param y The index of the row in the image.
+ * @param context Pointer to the BorderBatch structure.
+ * 
+ * @note Above and below a rectangle its border is one span of the full outer width, beside it two spans of
+ *       the border thickness. This is the union of the lines draw_border draws one by one.
+ */
+void border_batch_row(Png *image, png_bytep row, int y, void *context) {
+    BorderBatch *batch = context;
+    int bin = y / BORDER_BIN_ROWS;
+    int t = batch->thickness;
+
+    for (size_t i = batch->bin_offsets[bin]; i < batch->bin_offsets[bin + 1]; i++) {
+        Rect rect = batch->binned[i];
+        if (y < rect.y1 - t || y > rect.y2 + t) {
+            continue;
         }
 
-        /* Draw lower horizontal line */
-        y = y2 + t;
-        if (y >= 0 && y < image->height) {
-            png_bytep row = image->row_pointers[y];
-            for (int x = x1 - t; x <= x2 + t; x++) {
-                if (x >= 0 && x < image->width) {
-                    png_bytep px = &(row[x * 3]);
-                    draw_pixel(px, border_color);
-                }
-            }
+        int outer_begin = (rect.x1 - t > 0) ? rect.x1 - t : 0;
+        int outer_end = (rect.x2 + t + 1 < image->width) ? rect.x2 + t + 1 : image->width;
+        if (y < rect.y1 || y > rect.y2) {
+            /* Upper or lower part of the border */
+            fill_span(image, row, outer_begin, outer_end, batch->color);
+        } else {
+            /* Left and right parts of the border */
+            fill_span(image, row, outer_begin, (rect.x1 < image->width) ? rect.x1 : image->width, batch->color);
+            fill_span(image, row, (rect.x2 + 1 > 0) ? rect.x2 + 1 : 0, outer_end, batch->color);
         }
     }
+}
 
-    /* Draw vertical lines */
-    for (int t = 1; t <= border_thickness; t++) {
-        /* Draw left vertical line */
-        int x = x1 - t;
-        if (x >= 0 && x < image->width) {
-            for (int y = y1 - t; y <= y2 + t; y++) {
-                if (y >= 0 && y < image->height) {
-                    png_bytep px = &(image->row_pointers[y][(x * 3)]);
-                    draw_pixel(px, border_color);
+/**
+ * @brief Draws borders around many rectangles at once, going over the rows of the image a single time.
+ * 
+ * @param image Pointer to the Png structure representing the image.
+ * @param list Pointer to the RectList holding the rectangles, each with x1 <= x2 and y1 <= y2.
+ * @param border_color Pixel of the border color, in the format of the image.
+ * @param border_thickness The thickness of the borders.
+ * 
+ * @note The rectangles are binned by blocks of BORDER_BIN_ROWS rows and sorted by their left edge in every bin,
+ *       then every row is drawn once with span fills. All borders have one color, so the result is the same as
+ *       drawing them one by one in any order.
+ */
+void draw_borders(Png *image, RectList *list, const png_byte* border_color, int border_thickness) {
+    if (list->count == 0 || image->height == 0) {
+        return;
+    }
+
+    BorderBatch batch = {NULL, NULL, border_thickness, border_color};
+    int bin_count = (image->height + BORDER_BIN_ROWS - 1) / BORDER_BIN_ROWS;
+    batch.bin_offsets = calloc(bin_count + 1, sizeof(size_t));
+    if (batch.bin_offsets == NULL) {
+        printf("Error: Can not allocate memory for border bins\n");
+        raise_error(ERR_MEMORY_ALLOCATION_FAILURE);
+    }
+
+    /* Counting the rectangles of every bin, then placing them */
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < list->count; i++) {
+            Rect rect = list->rects[i];
+            int first_row = (rect.y1 - border_thickness > 0) ? rect.y1 - border_thickness : 0;
+            int last_row = (rect.y2 + border_thickness < image->height - 1) ? rect.y2 + border_thickness : image->height - 1;
+            for (int bin = first_row / BORDER_BIN_ROWS; bin <= last_row / BORDER_BIN_ROWS; bin++) {
+                if (pass == 0) {
+                    batch.bin_offsets[bin + 1]++;
+                } else {
+                    batch.binned[batch.bin_offsets[bin]++] = rect;
                 }
             }
         }
 
-        /* Draw right vertical line */
-        x = x2 + t;
-        if (x >= 0 && x < image->width) {
-            for (int y = y1 - t; y <= y2 + t; y++) {
-                if (y >= 0 && y < image->height) {
-                    png_bytep px = &(image->row_pointers[y][(x * 3)]);
-                    draw_pixel(px, border_color);
-                }
+        if (pass == 0) {
+            for (int bin = 0; bin < bin_count; bin++) {
+                batch.bin_offsets[bin + 1] += batch.bin_offsets[bin];
+            }
+            batch.binned = malloc(sizeof(Rect) * (batch.bin_offsets[bin_count] + 1));
+            if (batch.binned == NULL) {
+                printf("Error: Can not allocate memory for border bins\n");
+                raise_error(ERR_MEMORY_ALLOCATION_FAILURE);
             }
+        } else {
+            /* Placing moved every offset to the start of the next bin */
+            memmove(batch.bin_offsets + 1, batch.bin_offsets, sizeof(size_t) * bin_count);
+            batch.bin_offsets[0] = 0;
         }
     }
+
+    for (int bin = 0; bin < bin_count; bin++) {
+        qsort(batch.binned + batch.bin_offsets[bin], batch.bin_offsets[bin + 1] - batch.bin_offsets[bin], sizeof(Rect), compare_rects_x);
+    }
+
+    parallel_rows(image, border_batch_row, &batch);
+
+    free(batch.binned);
+    free(batch.bin_offsets);
 }
 
 /**
- * @brief Draws rectangle ornaments on the image.
+ * @brief Draws the rectangle ornament borders that lie in a single row.
  * 
  * @param image Pointer to the Png structure representing the image.
+ * @param row Pointer to the pixel data of the row.
+ * @param y The index of the row in the image.
+ * @param context Pointer to the OrnamentContext holding the borders.
+ */
+void rectangle_ornament_row(Png *image, png_bytep row, int y, void *context) {
+    OrnamentContext *ornament = context;
+    for (int i = 0; i < ornament->rect_count; i++) {
+        draw_border_row(image, row, y, ornament->rects[i], ornament->color, ornament->thickness);
+    }
+}
+
+/**
+ * @brief Computes the borders of the rectangle ornament for rectangle_ornament_row.
+ * 
+ * @param image Pointer to the Png structure representing the image, only its size is used.
  * @param ornament_thickness Thickness of the ornament rectangles.
  * @param ornament_count Number of ornament rectangles to draw.
- * @param color_values Array containing the RGB values of the ornament color.
+ * @param color Pixel of the ornament color, in the format of the image.
  * @param thickness String representing the thickness of the border.
+ * @param ornament Pointer to the OrnamentContext to be filled, its rects are taken from the arena of the job.
  */
-void rectangle_ornament(Png *image, int ornament_thickness, int ornament_count, int* color_values, char* thickness) {
-    int x1, y1, x2, y2;
-    x1 = ornament_thickness;
-    y1 = ornament_thickness;
-    x2 = image->width - ornament_thickness - 1;
-    y2 = image->height - ornament_thickness - 1;
+void prepare_rectangle_ornament(Png *image, int ornament_thickness, int ornament_count, const png_byte* color, char* thickness, OrnamentContext *ornament) {
+    OrnamentContext context = {{0}, atoi(thickness), ornament_count, NULL, 0, 0, 0};
+    memcpy(context.color, color, image->pixel_bytes);
+    if (context.thickness <= 0) {
+        printf("Error: Border thickness is not a positive integer\n");
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+    }
+    context.rects = arena_alloc(sizeof(Rect) * ornament_count);
+
+    /* Collect the borders first, then draw them all row by row */
+    Rect rect = {ornament_thickness, ornament_thickness, image->width - ornament_thickness - 1, image->height - ornament_thickness - 1};
     for (int i = 0; i < ornament_count; i++){
-        draw_border(image, x1, y1, x2, y2, color_values, thickness);
-        x1 += ornament_thickness * 2;
-        y1 += ornament_thickness * 2;
-        x2 -= ornament_thickness * 2;
-        y2 -= ornament_thickness * 2;
+        context.rects[context.rect_count++] = rect;
+        rect.x1 += ornament_thickness * 2;
+        rect.y1 += ornament_thickness * 2;
+        rect.x2 -= ornament_thickness * 2;
+        rect.y2 -= ornament_thickness * 2;
 
         /* Check if rectangles can fit */
-        if (x1 >= x2 || y1 >= y2){
+        if (rect.x1 >= rect.x2 || rect.y1 >= rect.y2){
             printf("Warning: Rectangles that cannot fit will be skipped\n");
             break;
         }
     }
+
+    *ornament = context;
 }
 
 /**
- * @brief Draws a circle ornament on the image.
+ * @brief Draws rectangle ornaments on the image.
+ * 
+ * @param image Pointer to the Png structure representing the image.
+ * @param ornament_thickness Thickness of the ornament rectangles.
+ * @param ornament_count Number of ornament rectangles to draw.
+ * @param color Pixel of the ornament color, in the format of the image.
+ * @param thickness String representing the thickness of the border.
+ */
+void rectangle_ornament(Png *image, int ornament_thickness, int ornament_count, const png_byte* color, char* thickness) {
+    OrnamentContext context;
+    prepare_rectangle_ornament(image, ornament_thickness, ornament_count, color, thickness, &context);
+    parallel_rows(image, rectangle_ornament_row, &context);
+}
+
+
+/**
+ * @brief Draws the part of the circle ornament that lies in a single row.
+ * 
+ * @note Instead of a distance per pixel, the x-extent of the circle in the row is computed once
+ *       and the two spans outside of it are filled.
  * 
  * @param image Pointer to the Png structure representing the image.
- * @param color_values Array containing the RGB values of the ornament color.
+ * @param row Pointer to the pixel data of the row.
+ * @param y The index of the row in the image.
+ * @param context Pointer to the OrnamentContext holding the color.
  */
-void circle_ornament(Png *image, int* color_values) {
+void circle_ornament_row(Png *image, png_bytep row, int y, void *context) {
+    OrnamentContext *ornament = context;
     int centerX = image->width / 2;
     int centerY = image->height / 2;
-    int radius = (centerX < centerY) ? centerX : centerY;
-    for (int y = 0; y < image->height; y++) {
-        for (int x = 0; x < image->width; x++) {
-            double distance = sqrt(pow(x - centerX, 2) + pow(y - centerY, 2));
-            if (distance <= radius) {
-                continue;
-            }
-            png_bytep ptr = &(image->row_pointers[y][x * 3]);
-            draw_pixel(ptr, color_values);
-        }
+    long long radius = (centerX < centerY) ? centerX : centerY;
+    long long dy = y - centerY;
+
+    /* The row misses the circle */
+    if (dy * dy > radius * radius) {
+        fill_span(image, row, 0, image->width, ornament->color);
+        return;
     }
+
+    /* Pixels with (x - centerX)^2 + dy^2 <= radius^2 are inside and stay untouched */
+    long long half_width = integer_sqrt(radius * radius - dy * dy);
+    long long inside_begin = centerX - half_width;
+    long long inside_end = centerX + half_width + 1;
+    fill_span(image, row, 0, (inside_begin > 0) ? (int)inside_begin : 0, ornament->color);
+    fill_span(image, row, (inside_end < image->width) ? (int)inside_end : image->width, image->width, ornament->color);
 }
 
 /**
- * @brief Draws semicircle ornaments on the image.
+ * @brief Draws a circle ornament on the image.
  * 
  * @param image Pointer to the Png structure representing the image.
- * @param ornament_thickness Thickness of the semicircle ornaments.
- * @param ornament_count Number of semicircle ornaments to draw.
- * @param color_values Array containing the RGB values of the ornament color.
+ * @param color Pixel of the ornament color, in the format of the image.
  */
-void semicircles_ornament(Png *image, int ornament_thickness, int ornament_count, int* color_values) {
-    int radiusX = ceil((double)(image->width - ornament_count * ornament_thickness) / (2 * ornament_count));
-    int radiusY = ceil((double)(image->height - ornament_count * ornament_thickness) / (2 * ornament_count));
-    int centerX = radiusX + ceil(ornament_thickness/2);
-    for (int i = 0; i < ornament_count; i++){
-        for (int x = centerX - radiusX - ceil(ornament_thickness/2); x < centerX + radiusX + ornament_thickness && x < image->width && x >= 0; x++){
-            /* Draw upper semicircles */
-            for (int y = 0; y < radiusX + ornament_thickness && y < image->height && y >= 0; y++){
-                int centerY = 0;
-                double distance = sqrt(pow(x - centerX, 2) + pow(y - centerY, 2));
-                if (distance < radiusX || distance > radiusX + ornament_thickness) {
-                    continue;
-                }
-                png_bytep ptr = &(image->row_pointers[y][x * 3]);
-                draw_pixel(ptr, color_values);
-            }
-            /* Draw lower semicircles */
-            for (int y = image->height - 1; y > image->height - 1 - radiusX - ornament_thickness && y >= 0 && y < image->height; y--){
-                int centerY = image->height - 1;
-                double distance = sqrt(pow(x - centerX, 2) + pow(y - centerY, 2));
-                if (distance < radiusX || distance > radiusX + ornament_thickness) {
-                    continue;
-                }
-                png_bytep ptr = &(image->row_pointers[y][x * 3]);
-                draw_pixel(ptr, color_values);
+void circle_ornament(Png *image, const png_byte* color) {
+    OrnamentContext context = {{0}, 0, 0, NULL, 0, 0, 0};
+    memcpy(context.color, color, image->pixel_bytes);
+    parallel_rows(image, circle_ornament_row, &context);
+}
+
+/**
+ * @brief Computes the x-extent of a ring in a row.
+ * 
+ * @param radius The inner radius of the ring.
+ * @param outer_radius The outer radius of the ring.
+ * @param dy The distance in rows from the center of the ring.
+ * @param inner Pointer where the smallest horizontal distance from the center inside the ring is stored.
+ * @param outer Pointer where the largest horizontal distance from the center inside the ring is stored.
+ * @return int 1 if the row crosses the ring, 0 otherwise.
+ * 
+ * @note A pixel is inside the ring when radius <= distance <= outer_radius, the same rule the per-pixel distance used.
+ */
+static int ring_extent(long long radius, long long outer_radius, long long dy, long long *inner, long long *outer) {
+    if (outer_radius < 0 || dy * dy > outer_radius * outer_radius) {
+        return 0;
+    }
+    *outer = integer_sqrt(outer_radius * outer_radius - dy * dy);
+
+    /* Smallest dx with dx^2 >= radius^2 - dy^2 */
+    long long missing = radius * radius - dy * dy;
+    *inner = (radius <= 0 || missing <= 0) ? 0 : integer_sqrt(missing - 1) + 1;
+    return *inner <= *outer;
+}
+
+/**
+ * @brief Fills the spans of a ring in a row that lie between two x-coordinates.
+ * 
+ * @param image Pointer to the Png structure representing the image.
+ * @param row Pointer to the pixel data of the row.
+ * @param center The x-coordinate of the center of the ring.
+ * @param inner The smallest horizontal distance from the center inside the ring.
+ * @param outer The largest horizontal distance from the center inside the ring.
+ * @param x_begin The first pixel that may be filled.
+ * @param x_end The pixel after the last one that may be filled.
+ * @param color Pixel of the color, in the format of the image.
+ */
+static void fill_ring_spans(Png *image, png_bytep row, long long center, long long inner, long long outer, long long x_begin, long long x_end, const png_byte* color) {
+    /* Left span, or the only one when the ring is cut by the row as a whole */
+    long long left_begin = center - outer;
+    long long left_end = (inner == 0) ? center + outer + 1 : center - inner + 1;
+    left_begin = (left_begin > x_begin) ? left_begin : x_begin;
+    left_end = (left_end < x_end) ? left_end : x_end;
+    if (left_begin < left_end) {
+        fill_span(image, row, (int)left_begin, (int)left_end, color);
+    }
+    if (inner == 0) {
+        return;
+    }
+
+    /* Right span */
+    long long right_begin = center + inner;
+    long long right_end = center + outer + 1;
+    right_begin = (right_begin > x_begin) ? right_begin : x_begin;
+    right_end = (right_end < x_end) ? right_end : x_end;
+    if (right_begin < right_end) {
+        fill_span(image, row, (int)right_begin, (int)right_end, color);
+    }
+}
+
+/**
+ * @brief Draws the parts of the semicircle ornaments that lie in a single row.
+ * 
+ * @param image Pointer to the Png structure representing the image.
+ * @param row Pointer to the pixel data of the row.
+ * @param y The index of the row in the image.
+ * @param context Pointer to the OrnamentContext holding the thickness, count, radii and color.
+ * 
+ * @note The upper semicircles share their center row, so the x-extent of their rings in the row is computed once
+ *       and reused for all of them, the same holds for the lower ones. Each semicircle is clipped to the same
+ *       bounding box the per-pixel version scanned.
+ */
+void semicircles_ornament_row(Png *image, png_bytep row, int y, void *context) {
+    OrnamentContext *ornament = context;
+    long long thickness = ornament->thickness;
+    long long radiusX = ornament->radius_x;
+    long long radiusY = ornament->radius_y;
+    long long width = image->width;
+    long long height = image->height;
+    long long inner, outer;
+
+    /* Upper and lower semicircles */
+    long long step = 2 * radiusX + thickness;
+    for (int side = 0; side < 2; side++) {
+        int active = side ? y > height - 1 - radiusX - thickness : y < radiusX + thickness;
+        long long dy = side ? y - (height - 1) : y;
+        if (!active || !ring_extent(radiusX, radiusX + thickness, dy, &inner, &outer)) {
+            continue;
+        }
+        /* Without a positive step every semicircle after the first is skipped or repeats it */
+        long long count = (step > 0) ? ornament->count : 1;
+        for (long long i = 0; i < count; i++) {
+            long long x_begin = i * step;
+            long long centerX = x_begin + radiusX + thickness / 2;
+            long long x_end = centerX + radiusX + thickness;
+            if (x_begin >= width) {
+                break;
             }
+            fill_ring_spans(image, row, centerX, inner, outer, x_begin, (x_end < width) ? x_end : width, ornament->color);
         }
-        centerX += 2 * radiusX + ornament_thickness;
     }
 
-    int centerY = radiusY + ceil(ornament_thickness/2);
-    for (int i = 0; i < ornament_count; i++){
-        for (int y = centerY - radiusY - ceil(ornament_thickness/2); y < centerY + radiusY + ornament_thickness && y < image->height && y >= 0; y++){
-            /* Draw left semicircles */
-            for (int x = 0; x < radiusY + ornament_thickness && x < image->width && x >= 0; x++){
-                int centerX = 0;
-                double distance = sqrt(pow(x - centerX, 2) + pow(y - centerY, 2));
-                if (distance < radiusY || distance > radiusY + ornament_thickness) {
-                    continue;
-                }
-                png_bytep ptr = &(image->row_pointers[y][x * 3]);
-                draw_pixel(ptr, color_values);
-            }
-            /* Draw right semicircles */
-            for (int x = image->width - 1; x > image->width - 1 - radiusY - ornament_thickness && x < image->width && x >= 0; x--){
-                int centerX = image->width - 1;
-                double distance = sqrt(pow(x - centerX, 2) + pow(y - centerY, 2));
-                if (distance < radiusY || distance > radiusY + ornament_thickness) {
-                    continue;
-                }
-                png_bytep ptr = &(image->row_pointers[y][x * 3]);
-                draw_pixel(ptr, color_values);
-            }
+    /* Left and right semicircles */
+    step = 2 * radiusY + thickness;
+    long long span = 2 * radiusY + thickness + thickness / 2;
+    long long first = 0;
+    long long last = 0;
+    if (step > 0) {
+        /* Only the semicircles whose rows contain y */
+        first = (y - span + 1 > 0) ? (y - span + 1 + step - 1) / step : 0;
+        last = (y / step < ornament->count - 1) ? y / step : ornament->count - 1;
+    }
+    for (long long i = first; i <= last; i++) {
+        long long y_begin = i * step;
+        long long centerY = y_begin + radiusY + thickness / 2;
+        if (y < y_begin || y >= centerY + radiusY + thickness) {
+            continue;
         }
-        centerY += 2 * radiusY + ornament_thickness;
+        if (!ring_extent(radiusY, radiusY + thickness, y - centerY, &inner, &outer)) {
+            continue;
+        }
+        /* Left semicircle */
+        long long left_end = radiusY + thickness;
+        fill_ring_spans(image, row, 0, inner, outer, 0, (left_end < width) ? left_end : width, ornament->color);
+        /* Right semicircle */
+        long long right_begin = width - radiusY - thickness;
+        fill_ring_spans(image, row, width - 1, inner, outer, (right_begin > 0) ? right_begin : 0, width, ornament->color);
     }
 }
+
+/**
+ * @brief Computes the radii of the semicircles ornament for semicircles_ornament_row.
+ * 
+ * @param image Pointer to the Png structure representing the image, only its size is used.
+ * @param ornament_thickness Thickness of the semicircles.
+ * @param ornament_count Number of semicircles on each side.
+ * @param color Pixel of the ornament color, in the format of the image.
+ * @param ornament Pointer to the OrnamentContext to be filled.
+ */
+void prepare_semicircles_ornament(Png *image, int ornament_thickness, int ornament_count, const png_byte* color, OrnamentContext *ornament) {
+    OrnamentContext context = {{0}, ornament_thickness, ornament_count, NULL, 0, 0, 0};
+    memcpy(context.color, color, image->pixel_bytes);
+    /* Rounded up, a span left without room is truncated towards zero, which rounds it up as well */
+    int span_x = image->width - ornament_count * ornament_thickness;
+    int span_y = image->height - ornament_count * ornament_thickness;
+    int diameters = 2 * ornament_count;
+    context.radius_x = (span_x > 0) ? (span_x + diameters - 1) / diameters : span_x / diameters;
+    context.radius_y = (span_y > 0) ? (span_y + diameters - 1) / diameters : span_y / diameters;
+    *ornament = context;
+}
+
+/**
+ * @brief Draws semicircle ornaments on the image.
+ * 
+ * @param image Pointer to the Png structure representing the image.
+ * @param ornament_thickness Thickness of the semicircle ornaments.
+ * @param ornament_count Number of semicircle ornaments to draw.
+ * @param color Pixel of the ornament color, in the format of the image.
+ */
+void semicircles_ornament(Png *image, int ornament_thickness, int ornament_count, const png_byte* color) {
+    OrnamentContext context;
+    prepare_semicircles_ornament(image, ornament_thickness, ornament_count, color, &context);
+    parallel_rows(image, semicircles_ornament_row, &context);
+}
@@ -0,0 +1,336 @@
+#include "errors.h"
+#include "structures.h"
+#include "error_handler.h"
+#include "thread_handler.h"
+#include "storage_handler.h"
+#include "profile_handler.h"
+
+/* Smallest number of filtered bytes worth a strip of its own, smaller strips compress worse. */
+#define STRIP_MIN_BYTES (256 * 1024)
+
+/* Largest number of filtered bytes in a strip, zlib takes the length of its input as 32 bits. */
+#define STRIP_MAX_BYTES (1 << 30)
+
+/* Number of strips given to every thread, more strips even out rows of different cost. */
+#define STRIPS_PER_THREAD 4
+
+/* Size of the deflate window, the dictionary of a strip is the end of the previous one. */
+#define DEFLATE_WINDOW 32768
+
+/* Size of the IDAT chunks when the encoder settings give no buffer size. */
+#define IDAT_CHUNK_SIZE (256 * 1024)
+
+/**
+ * @brief Predicts a byte from its neighbours the way the Paeth filter does.
+ *
+ * @param a The byte of the previous pixel.
+ * @param b The byte above.
+ * @param c The byte of the previous pixel above.
+ * @return int The one of a, b and c closest to a + b - c.
+ */
+static int paeth_predictor(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return (pb <= pc) ? b : c;
+}
+
+/**
+ * @brief Filters a row with one filter type.
+ *
+ * @param type The filter type, from 0 (None) to 4 (Paeth).
+ * @param row The pixel data of the row.
+ * @param previous The pixel data of the row above, all zeros for the first row.
+ * @param row_bytes The number of bytes of pixel data in the row.
+ * @param bpp The distance in bytes to the matching byte of the previous pixel.
+ * @param out The buffer of row_bytes + 1 bytes the filter type and the filtered bytes are written to.
+ *
+ * @return unsigned long The sum of the filtered bytes taken as signed values, the smaller the better the row compresses.
+ */
+static unsigned long filter_row(int type, png_const_bytep row, png_const_bytep previous, size_t row_bytes, int bpp, png_bytep out) {
+    unsigned long sum = 0;
+    out[0] = type;
+    out++;
+
+    for (size_t i = 0; i < row_bytes; i++) {
+        int a = (i >= (size_t)bpp) ? row[i - bpp] : 0;
+        int b = previous[i];
+        int c = (i >= (size_t)bpp) ? previous[i - bpp] : 0;
+        int prediction;
+        switch (type) {
+            case 1: prediction = a; break;
+            case 2: prediction = b; break;
+            case 3: prediction = (a + b) / 2; break;
+            case 4: prediction = paeth_predictor(a, b, c); break;
+            default: prediction = 0; break;
+        }
+        png_byte value = (png_byte)(row[i] - prediction);
+        out[i] = value;
+        sum += (value < 128) ? value : 256 - value;
+    }
+
+    return sum;
+}
+
+/**
+ * @brief Filters a row with the allowed filter that gives the smallest sum, the heuristic libpng uses.
+ *
+ * @param encoder A pointer to the ParallelEncoder structure.
+ * @param y The index of the row.
+ * @param zeros A row of zeros standing for the row above the first one.
+ * @param scratch A buffer of 2 * (row_bytes + 1) bytes.
+ * @param out The buffer of row_bytes + 1 bytes the filtered row is written to.
+ *
+ * This function does not return a value.
+ *
+ * @note The result only depends on the row and the one above, so any strip can filter the rows before it again.
+ */
+static void filter_best(ParallelEncoder *encoder, int y, png_const_bytep zeros, png_bytep scratch, png_bytep out) {
+    static const int masks[5] = {PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH};
+    png_const_bytep row = encoder->image->row_pointers[y];
+    png_const_bytep previous = (y > 0) ? encoder->image->row_pointers[y - 1] : zeros;
+    size_t size = encoder->row_bytes + 1;
+    unsigned long best_sum = 0;
+    png_bytep best = NULL;
+
+    for (int type = 0; type < 5; type++) {
+        if (!(encoder->filters & masks[type])) {
+            continue;
+        }
+        /* Alternate between two buffers, so the best row so far is kept */
+        png_bytep candidate = (best == scratch) ? scratch + size : scratch;
+        unsigned long sum = filter_row(type, row, previous, encoder->row_bytes, encoder->bytes_per_pixel, candidate);
+        if (best == NULL || sum < best_sum) {
+            best = candidate;
+            best_sum = sum;
+        }
+    }
+
+    memcpy(out, best, size);
+}
+
+/**
+ * @brief Filters and compresses the rows of one strip as a raw deflate stream.
+ *
+ * @param index The index of the strip.
+ * @param context A pointer to the ParallelEncoder structure.
+ *
+ * This function does not return a value.
+ *
+ * @note The end of the previous strip is the dictionary of the stream, so matches may reach back into it like in a single stream.
+ *       Every strip but the last ends with a full flush, so the streams can be joined one after another.
+ */
+static void encode_strip(int index, void *context) {
+    ParallelEncoder *encoder = context;
+    EncodedStrip *strip = &encoder->strips[index];
+    int height = encoder->image->height;
+    int y_begin = (int)((long long)height * index / encoder->strip_count);
+    int y_end = (int)((long long)height * (index + 1) / encoder->strip_count);
+    size_t size = encoder->row_bytes + 1;
+
+    /* Rows before the strip that fill the dictionary */
+    int dictionary_rows = (int)((DEFLATE_WINDOW + size - 1) / size);
+    int y_dictionary = (y_begin - dictionary_rows > 0) ? y_begin - dictionary_rows : 0;
+
+    strip->raw_size = size * (y_end - y_begin);
+    PROFILE_COUNT(allocations, 3);
+    png_bytep filtered = malloc(size * (y_end - y_dictionary));
+    png_bytep scratch = malloc(size * 2);
+    png_bytep zeros = calloc(encoder->row_bytes, 1);
+    if (filtered == NULL || scratch == NULL || zeros == NULL) {
+        strip->failed = 1;
+        free(filtered);
+        free(scratch);
+        free(zeros);
+        return;
+    }
+
+    load_rows(encoder->image, y_dictionary, y_end);
+    for (int y = y_dictionary; y < y_end; y++) {
+        filter_best(encoder, y, zeros, scratch, filtered + size * (y - y_dictionary));
+    }
+    release_rows(encoder->image, y_begin, y_end);
+    png_bytep rows = filtered + size * (y_begin - y_dictionary);
+    strip->adler = adler32(adler32(0L, Z_NULL, 0), rows, strip->raw_size);
+
+    z_stream stream = {0};
+    int last = (index == encoder->strip_count - 1);
+    if (deflateInit2(&stream, encoder->compression_level, Z_DEFLATED, -15, 8, encoder->strategy) != Z_OK) {
+        strip->failed = 1;
+    } else {
+        size_t dictionary_size = rows - filtered;
+        if (dictionary_size > DEFLATE_WINDOW) {
+            dictionary_size = DEFLATE_WINDOW;
+        }
+        if (dictionary_size > 0) {
+            deflateSetDictionary(&stream, rows - dictionary_size, dictionary_size);
+        }
+
+        /* The bound covers a whole stream, the flush marker needs a few bytes more */
+        size_t capacity = deflateBound(&stream, strip->raw_size) + 16;
+        PROFILE_COUNT(allocations, 1);
+        strip->data = malloc(capacity);
+        if (strip->data == NULL) {
+            strip->failed = 1;
+        } else {
+            stream.next_in = rows;
+            stream.avail_in = strip->raw_size;
+            stream.next_out = strip->data;
+            stream.avail_out = capacity;
+            int status = deflate(&stream, last ? Z_FINISH : Z_FULL_FLUSH);
+            if ((last && status != Z_STREAM_END) || (!last && (status != Z_OK || stream.avail_in != 0 || stream.avail_out == 0))) {
+                strip->failed = 1;
+            }
+            strip->size = capacity - stream.avail_out;
+        }
+        deflateEnd(&stream);
+    }
+
+    free(filtered);
+    free(scratch);
+    free(zeros);
+}
+
+/**
+ * @brief Collects bytes of the zlib stream into IDAT chunks of a fixed size.
+ *
+ * @param png_ptr The libpng write structure the chunks are written with.
+ * @param chunk The buffer of chunk_size bytes holding the chunk being filled.
+ * @param chunk_size The size of a full chunk.
+ * @param filled A pointer to the number of bytes already in chunk.
+ * @param data The bytes to be added.
+ * @param size The number of bytes to be added.
+ *
+ * This function does not return a value.
+ */
+static void write_idat_bytes(png_structp png_ptr, png_bytep chunk, size_t chunk_size, size_t *filled, png_const_bytep data, size_t size) {
+    while (size > 0) {
+        size_t part = (chunk_size - *filled < size) ? chunk_size - *filled : size;
+        memcpy(chunk + *filled, data, part);
+        *filled += part;
+        data += part;
+        size -= part;
+        if (*filled == chunk_size) {
+            png_write_chunk(png_ptr, (png_const_bytep)"IDAT", chunk, chunk_size);
+            *filled = 0;
+        }
+    }
+}
+
+/**
+ * @brief Writes the image data as IDAT chunks, filtering and compressing strips of rows on the thread pool.
+ *
+ * @param png_ptr The libpng write structure, the header of the image must already be written.
+ * @param image A pointer to the Png structure containing the image.
+ * @param settings A pointer to the EncoderSettings structure, NULL to keep the defaults.
+ *
+ * @return int 1 if the data was written, 0 if the image is too small to be split or no thread is free, then nothing was written.
+ *
+ * @note Replaces the libpng error handling of png_ptr while it writes, the caller has to set its own again afterwards.
+ *
+ * @note The strips form one zlib stream: a header, the raw deflate streams one after another and the Adler-32 of all filtered rows,
+ *       combined from the checksums of the strips. The defaults match libpng: all filters, Z_FILTERED and the default level.
+ */
+int write_png_rows_parallel(png_structp png_ptr, Png *image, EncoderSettings *settings) {
+    ParallelEncoder encoder = {0};
+    encoder.image = image;
+    encoder.row_bytes = (size_t)image->width * image->pixel_bytes;
+    encoder.bytes_per_pixel = image->pixel_bytes;
+    encoder.compression_level = (settings && settings->compression_level >= 0) ? settings->compression_level : Z_DEFAULT_COMPRESSION;
+    encoder.filters = (settings && settings->filters >= 0) ? settings->filters : PNG_ALL_FILTERS;
+    encoder.strategy = (settings && settings->strategy >= 0) ? settings->strategy : (encoder.filters == PNG_FILTER_NONE ? Z_DEFAULT_STRATEGY : Z_FILTERED);
+
+    /* Enough strips to keep every thread busy, but none too small to compress well */
+    size_t total = (encoder.row_bytes + 1) * (size_t)image->height;
+    int thread_count = get_free_thread_count();
+    size_t strip_count = (size_t)thread_count * STRIPS_PER_THREAD;
+    if (strip_count > total / STRIP_MIN_BYTES) {
+        strip_count = total / STRIP_MIN_BYTES;
+    }
+    if (strip_count < total / STRIP_MAX_BYTES + 1) {
+        strip_count = total / STRIP_MAX_BYTES + 1;
+    }
+    if (strip_count > (size_t)image->height) {
+        strip_count = image->height;
+    }
+    if (thread_count < 2 || strip_count < 2) {
+        return 0;
+    }
+    encoder.strip_count = (int)strip_count;
+
+    encoder.strips = calloc(encoder.strip_count, sizeof(EncodedStrip));
+    if (encoder.strips == NULL) {
+        printf("Error: Can not allocate memory for encoder strips\n");
+        raise_error(ERR_MEMORY_ALLOCATION_FAILURE);
+    }
+
+    /* Compressed strips and the chunk are freed before an error goes on, the caller drops the output */
+    jmp_buf recovery;
+    jmp_buf *outer_recovery = get_error_recovery();
+    png_bytep volatile chunk = NULL;
+    int code = setjmp(recovery);
+    if (code != 0) {
+        set_error_recovery(outer_recovery);
+        for (int i = 0; i < encoder.strip_count; i++) {
+            free(encoder.strips[i].data);
+        }
+        free(encoder.strips);
+        free(chunk);
+        raise_error(code);
+    }
+    set_error_recovery(&recovery);
+
+    run_parallel(encoder.strip_count, encode_strip, &encoder);
+
+    for (int i = 0; i < encoder.strip_count; i++) {
+        if (encoder.strips[i].failed) {
+            printf("Error: Can not compress image data\n");
+            raise_error(ERR_FILE_WRITE_ERROR);
+        }
+    }
+
+    size_t chunk_size = (settings && settings->buffer_size > 0) ? settings->buffer_size : IDAT_CHUNK_SIZE;
+    chunk = malloc(chunk_size);
+    if (chunk == NULL) {
+        printf("Error: Can not allocate memory for IDAT chunk\n");
+        raise_error(ERR_MEMORY_ALLOCATION_FAILURE);
+    }
+    size_t filled = 0;
+
+    /* Errors of libpng while the chunks are written go through the recovery above, the caller sets its own again after */
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        printf("Error: Unknown\n");
+        raise_error(ERR_FILE_WRITE_ERROR);
+    }
+
+    /* zlib header: deflate with a 32K window, the level hint and the check bits */
+    int level = encoder.compression_level == Z_DEFAULT_COMPRESSION ? 6 : encoder.compression_level;
+    int level_hint = (level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3;
+    png_byte header[2] = {0x78, level_hint << 6};
+    header[1] += (31 - (header[0] * 256 + header[1]) % 31) % 31;
+    write_idat_bytes(png_ptr, chunk, chunk_size, &filled, header, 2);
+
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (int i = 0; i < encoder.strip_count; i++) {
+        EncodedStrip *strip = &encoder.strips[i];
+        write_idat_bytes(png_ptr, chunk, chunk_size, &filled, strip->data, strip->size);
+        adler = adler32_combine(adler, strip->adler, strip->raw_size);
+        free(strip->data);
+        strip->data = NULL;
+    }
+
+    png_byte trailer[4] = {adler >> 24, adler >> 16, adler >> 8, adler};
+    write_idat_bytes(png_ptr, chunk, chunk_size, &filled, trailer, 4);
+    if (filled > 0) {
+        png_write_chunk(png_ptr, (png_const_bytep)"IDAT", chunk, filled);
+    }
+
+    set_error_recovery(outer_recovery);
+    free(chunk);
+    free(encoder.strips);
+    return 1;
+}
@@ -0,0 +1,44 @@
+#include "errors.h"
+#include "structures.h"
+#include "error_handler.h"
+
+/* Point the current thread returns to on an error, without one errors end the process. */
+static __thread jmp_buf *recovery_point = NULL;
+
+/**
+ * @brief Sets the point the current thread jumps back to when an error is raised.
+ * 
+ * @param recovery A pointer to the buffer filled by setjmp, or NULL to end the process on errors again.
+ * 
+ * This function does not return a value.
+ */
+void set_error_recovery(jmp_buf *recovery) {
+    recovery_point = recovery;
+}
+
+/**
+ * @brief Returns the point the current thread jumps back to when an error is raised.
+ * 
+ * @return jmp_buf* The buffer given to set_error_recovery, NULL if errors end the process.
+ * 
+ * @note Lets a function holding resources catch an error with its own point, free them and raise the error again.
+ */
+jmp_buf* get_error_recovery() {
+    return recovery_point;
+}
+
+/**
+ * @brief Stops the current task after its error message was printed.
+ * 
+ * @param code The error code from errors.h.
+ * 
+ * This function does not return.
+ * 
+ * @note Jumps to the recovery point of the current thread with code as the result of setjmp if one is set, ends the process with code otherwise.
+ */
+void raise_error(int code) {
+    if (recovery_point != NULL) {
+        longjmp(*recovery_point, code);
+    }
+    exit(code);
+}
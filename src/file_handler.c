@@ -1,91 +1,318 @@
 #include "errors.h"
 #include "structures.h"
+#include "error_handler.h"
+#include "encoder_handler.h"
+#include "io_handler.h"
+#include "pixel_handler.h"
+#include "storage_handler.h"
+#include "profile_handler.h"
 
 /**
- * @brief Reads a PNG file and stores its information and pixel data in a Png structure.
- * 
- * @param file_name A string representing the file name/path of the PNG image to be read.
- * @param image A pointer to the Png structure where the image data and information will be stored.
+ * @brief Allocates one aligned pixel buffer for some rows of an image and points their row pointers into it.
+ *
+ * @param image A pointer to the Png structure whose width and height are already set.
+ * @param row_bytes The number of bytes of pixel data in one row.
+ * @param y_begin The first row held in memory.
+ * @param y_end The row after the last one held in memory.
+ *
+ * @note Every row starts on a PIXEL_ALIGNMENT boundary, so image->stride is row_bytes rounded up to PIXEL_ALIGNMENT.
+ *       The row pointers of the other rows are NULL. Buffers left in image by a previous image are reused when they are large enough.
+ *       Images over the memory limit get a buffer backed by a scratch file, see allocate_pixel_storage.
  */
-void read_png_file(char *file_name, Png *image) {
+void allocate_png_rows(Png *image, size_t row_bytes, int y_begin, int y_end) {
     int y;
-    char header[8];
 
-    /* Open file */
-    FILE *fp = fopen(file_name, "rb");
-    if (!fp) {
-        printf("Error: Can not read file %s\n", file_name);
-        exit(ERR_FILE_NOT_FOUND);
+    image->stride = (row_bytes + PIXEL_ALIGNMENT - 1) / PIXEL_ALIGNMENT * PIXEL_ALIGNMENT;
+    image->rows_begin = y_begin;
+    image->rows_end = y_end;
+
+    /* Allocate one aligned buffer for all rows, backed by a scratch file over the memory limit */
+    size_t size = image->stride * (size_t)(y_end - y_begin);
+    if (size > image->pixels_capacity) {
+        free_pixel_storage(image->pixels, image->pixels_capacity, image->pixels_mapped);
+        image->pixels = NULL;
+        image->pixels_capacity = 0;
+
+        image->pixels = allocate_pixel_storage(size, &image->pixels_mapped);
+        image->pixels_capacity = size;
     }
 
-    /* Read first 8 bytes to verify PNG file */
-    fread(header, 1, 8, fp);
-    if (png_sig_cmp((const unsigned char *)header, 0, 8)) {
+    /* Row pointers are views into the pixel buffer */
+    if (image->height > image->rows_capacity) {
+        free(image->row_pointers);
+        image->rows_capacity = 0;
+        PROFILE_COUNT(allocations, 1);
+        image->row_pointers = malloc(sizeof(png_bytep) * image->height);
+        if (image->row_pointers == NULL) {
+            printf("Error: Can not allocate memory for image->row_pointers\n");
+            raise_error(ERR_MEMORY_ALLOCATION_FAILURE);
+        }
+        image->rows_capacity = image->height;
+    }
+    for (y = 0; y < image->height; y++) {
+        image->row_pointers[y] = (y >= y_begin && y < y_end) ? image->pixels + (size_t)(y - y_begin) * image->stride : NULL;
+    }
+}
+
+/**
+ * @brief Allocates one aligned pixel buffer for the whole image and points every row pointer into it.
+ *
+ * @param image A pointer to the Png structure whose width and height are already set.
+ * @param row_bytes The number of bytes of pixel data in one row.
+ *
+ * @note See allocate_png_rows.
+ */
+void allocate_png_pixels(Png *image, size_t row_bytes) {
+    allocate_png_rows(image, row_bytes, 0, image->height);
+}
+
+/**
+ * @brief Frees the pixel buffer and row pointers of an image.
+ *
+ * @param image A pointer to the Png structure whose buffers are freed.
+ *
+ * This function does not return a value.
+ */
+void free_png_pixels(Png *image) {
+    free_pixel_storage(image->pixels, image->pixels_capacity, image->pixels_mapped);
+    free(image->row_pointers);
+    image->pixels = NULL;
+    image->row_pointers = NULL;
+    image->pixels_capacity = 0;
+    image->rows_capacity = 0;
+    image->pixels_mapped = 0;
+    image->rows_begin = 0;
+    image->rows_end = 0;
+}
+
+/**
+ * @brief Opens a PNG file and reads its header into a Png structure.
+ *
+ * @param file_name A string representing the file name/path of the PNG image to be read, '-' for stdin.
+ * @param image A pointer to the Png structure where the image information will be stored.
+ * @param input A pointer to the PngInput structure the file is opened in, positioned right after the header chunks.
+ *
+ * @note Only the libpng structures and header fields of image are set, its pixel buffers are left as they are.
+ *       color_type and bit_depth keep the values of the file, format describes the pixels as they are read.
+ */
+static void open_png_reader(char *file_name, Png *image, PngInput *input) {
+    open_png_input(file_name, input);
+
+    /* Check first 8 bytes to verify PNG file */
+    if (input->size < 8 || png_sig_cmp(input->data, 0, 8)) {
         printf("Error: %s probably is not a PNG file\n", file_name);
-        fclose(fp);
-        exit(ERR_FILE_READ_ERROR);
+        close_png_input(input);
+        raise_error(ERR_FILE_READ_ERROR);
     }
+    input->position = 8;
 
     /* Create PNG read structure */
     image->png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!image->png_ptr) {
         printf("Error: Can not create PNG struct\n");
-        fclose(fp);
-        exit(ERR_FILE_READ_ERROR);
+        close_png_input(input);
+        raise_error(ERR_FILE_READ_ERROR);
     }
 
     /* Create PNG info structure */
     image->info_ptr = png_create_info_struct(image->png_ptr);
     if (!image->info_ptr) {
         printf("Error: Can not create PNG info struct\n");
-        fclose(fp);
+        close_png_input(input);
         png_destroy_read_struct(&image->png_ptr, NULL, NULL);
-        exit(ERR_FILE_READ_ERROR);
+        raise_error(ERR_FILE_READ_ERROR);
     }
 
     /* Set up error handling */
     if (setjmp(png_jmpbuf(image->png_ptr))) {
         printf("Error: Unknown\n");
-        fclose(fp);
+        close_png_input(input);
         png_destroy_read_struct(&image->png_ptr, &image->info_ptr, NULL);
-        exit(ERR_FILE_READ_ERROR);
+        raise_error(ERR_FILE_READ_ERROR);
     }
 
     /* Initialize IO */
-    png_init_io(image->png_ptr, fp);
+    set_png_input(image->png_ptr, input);
     png_set_sig_bytes(image->png_ptr, 8);
+
+    /* Any size the format allows, larger images than libpng accepts by default are paged through a scratch file */
+    png_set_user_limits(image->png_ptr, PNG_UINT_31_MAX, PNG_UINT_31_MAX);
     png_read_info(image->png_ptr, image->info_ptr);
     image->width = png_get_image_width(image->png_ptr, image->info_ptr);
     image->height = png_get_image_height(image->png_ptr, image->info_ptr);
     image->color_type = png_get_color_type(image->png_ptr, image->info_ptr);
     image->bit_depth = png_get_bit_depth(image->png_ptr, image->info_ptr);
+
+    /* Palette and low bit depth images are expanded to 8 bits per channel, transparent colors to an alpha channel */
+    if (image->color_type == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(image->png_ptr);
+    }
+    if (image->color_type == PNG_COLOR_TYPE_GRAY && image->bit_depth < 8) {
+        png_set_expand_gray_1_2_4_to_8(image->png_ptr);
+    }
+    if (png_get_valid(image->png_ptr, image->info_ptr, PNG_INFO_tRNS)) {
+        png_set_tRNS_to_alpha(image->png_ptr);
+    }
     image->number_of_passes = png_set_interlace_handling(image->png_ptr);
+    png_read_update_info(image->png_ptr, image->info_ptr);
+
+    /* Check if the pixels can be processed */
+    if (!set_pixel_format(image, png_get_color_type(image->png_ptr, image->info_ptr), png_get_bit_depth(image->png_ptr, image->info_ptr))) {
+        printf("Error: Unsupported color type in the file\n");
+        close_png_input(input);
+        png_destroy_read_struct(&image->png_ptr, &image->info_ptr, NULL);
+        raise_error(ERR_FILE_READ_ERROR);
+    }
+}
+
+/**
+ * @brief Creates a PNG file and writes the header of the given image into it.
+ *
+ * @param file_name A string representing the file name/path where the PNG image will be saved, '-' for stdout.
+ * @param image A pointer to the Png structure containing information about the PNG image.
+ * @param png_ptr A pointer where the created libpng write structure will be stored.
+ * @param info_ptr A pointer where the created libpng info structure will be stored.
+ * @param settings A pointer to the EncoderSettings structure, NULL to keep the libpng defaults.
+ * @param output A pointer to the PngOutput structure the file is opened in, ready for the image rows to be written.
+ */
+static void open_png_writer(char *file_name, Png *image, png_structp *png_ptr, png_infop *info_ptr, EncoderSettings *settings, PngOutput *output) {
+
+    /* Open file */
+    open_png_output(file_name, output, settings ? settings->output_buffer_size : 0);
 
-    /* Check if color type is RGB */
-    if (png_get_color_type(image->png_ptr, image->info_ptr) != PNG_COLOR_TYPE_RGB) {
-        printf("Error: Not RGB color type in the file\n");
-        exit(ERR_FILE_READ_ERROR);
+    /* Create PNG write structure */
+    *png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!*png_ptr) {
+        printf("Error: Can not create PNG write struct\n");
+        close_png_output(output, 0);
+        raise_error(ERR_FILE_WRITE_ERROR);
     }
 
-    /* Allocate memory for image rows */
-    image->row_pointers = malloc(sizeof(png_bytep) * image->height);
-    if (image->row_pointers == NULL) {
-        printf("Error: Can not allocate memory for image->row_pointers while reading\n");
-        exit(ERR_MEMORY_ALLOCATION_FAILURE);
+    /* Create PNG info structure */
+    *info_ptr = png_create_info_struct(*png_ptr);
+    if (!*info_ptr) {
+        printf("Error: Can not create PNG info struct while writing\n");
+        close_png_output(output, 0);
+        png_destroy_write_struct(png_ptr, NULL);
+        raise_error(ERR_FILE_WRITE_ERROR);
     }
-    for (y = 0; y < image->height; y++) {
-        image->row_pointers[y] = malloc(png_get_rowbytes(image->png_ptr, image->info_ptr));
-        if (image->row_pointers[y] == NULL){
-            printf("Error: Can not allocate memory for pixel while reading\n");
-            exit(ERR_MEMORY_ALLOCATION_FAILURE);
+
+    /* Set up error handling */
+    if (setjmp(png_jmpbuf(*png_ptr))) {
+        printf("Error: Unknown\n");
+        close_png_output(output, 0);
+        png_destroy_write_struct(png_ptr, info_ptr);
+        raise_error(ERR_FILE_WRITE_ERROR);
+    }
+
+    /* Initialize IO */
+    set_png_output(*png_ptr, output);
+
+    /* Set up the encoder, unset values keep the libpng defaults */
+    if (settings != NULL) {
+        if (settings->compression_level >= 0) {
+            png_set_compression_level(*png_ptr, settings->compression_level);
+        }
+        if (settings->strategy >= 0) {
+            png_set_compression_strategy(*png_ptr, settings->strategy);
+        }
+        if (settings->filters >= 0) {
+            png_set_filter(*png_ptr, PNG_FILTER_TYPE_BASE, settings->filters);
+        }
+        if (settings->buffer_size > 0) {
+            png_set_compression_buffer_size(*png_ptr, settings->buffer_size);
         }
     }
 
-    /* Read image rows */
-    png_read_image(image->png_ptr, image->row_pointers);
+    png_set_IHDR(*png_ptr, *info_ptr, image->width, image->height, image->format->bit_depth, image->format->color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    png_write_info(*png_ptr, *info_ptr);
+}
+
+/**
+ * @brief Reads the next rows of a non-interlaced image into its pixel buffer, a tile at a time.
+ *
+ * @param image A pointer to the Png structure being read, the rows have to be held in memory.
+ * @param y_begin The first row, the next one libpng decodes.
+ * @param y_end The row after the last one.
+ *
+ * This function does not return a value.
+ *
+ * @note Every tile is released once it is read, so finished tiles of a large image can leave memory.
+ */
+static void read_png_rows(Png *image, int y_begin, int y_end) {
+    int tile_height = get_tile_height(image);
+    for (int y = y_begin; y < y_end; y += tile_height) {
+        int tile_end = (y_end - y > tile_height) ? y + tile_height : y_end;
+        png_read_rows(image->png_ptr, image->row_pointers + y, NULL, tile_end - y);
+        release_rows(image, y, tile_end);
+    }
+}
+
+/**
+ * @brief Writes rows of an image held in memory, a tile at a time.
+ *
+ * @param png_ptr The libpng write structure, the next row it expects is y_begin.
+ * @param image A pointer to the Png structure holding the rows.
+ * @param y_begin The first row.
+ * @param y_end The row after the last one.
+ *
+ * This function does not return a value.
+ */
+static void write_png_rows(png_structp png_ptr, Png *image, int y_begin, int y_end) {
+    int tile_height = get_tile_height(image);
+    for (int y = y_begin; y < y_end; y += tile_height) {
+        int tile_end = (y_end - y > tile_height) ? y + tile_height : y_end;
+        load_rows(image, y, tile_end);
+        png_write_rows(png_ptr, image->row_pointers + y, tile_end - y);
+        release_rows(image, y, tile_end);
+    }
+}
+
+/**
+ * @brief Reads the header and metadata chunks of a PNG file, without decoding any pixel.
+ *
+ * @param file_name A string representing the file name/path of the PNG image to be read.
+ * @param image A pointer to the Png structure where the image information will be stored, its libpng structures
+ *              have to be destroyed by the caller.
+ *
+ * @note The file is mapped, so only the pages of the chunks before the image data are read from it.
+ */
+void read_png_header(char *file_name, Png *image) {
+    PngInput input;
+    open_png_reader(file_name, image, &input);
+    close_png_input(&input);
+}
+
+/**
+ * @brief Reads a PNG file and stores its information and pixel data in a Png structure.
+ * 
+ * @param file_name A string representing the file name/path of the PNG image to be read.
+ * @param image A pointer to the Png structure where the image data and information will be stored.
+ */
+void read_png_file(char *file_name, Png *image) {
+    PngInput input;
+    open_png_reader(file_name, image, &input);
+
+    /* Set up error handling */
+    if (setjmp(png_jmpbuf(image->png_ptr))) {
+        printf("Error: Unknown\n");
+        close_png_input(&input);
+        png_destroy_read_struct(&image->png_ptr, &image->info_ptr, NULL);
+        raise_error(ERR_FILE_READ_ERROR);
+    }
+
+    /* Allocate memory for image rows */
+    allocate_png_pixels(image, png_get_rowbytes(image->png_ptr, image->info_ptr));
+
+    /* Read image rows, a tile at a time so that finished tiles of a large image can leave memory */
+    if (image->number_of_passes == 1) {
+        read_png_rows(image, 0, image->height);
+    } else {
+        png_read_image(image->png_ptr, image->row_pointers);
+    }
 
     /* Close file */
-    fclose(fp);
+    close_png_input(&input);
 }
 
 /**
@@ -93,61 +320,169 @@ void read_png_file(char *file_name, Png *image) {
  * 
  * @param file_name A string representing the file name/path where the PNG image will be saved.
  * @param image A pointer to the Png structure containing information about the PNG image.
+ * @param settings A pointer to the EncoderSettings structure, NULL to keep the libpng defaults.
  */
-void write_png_file(char *file_name, Png *image) {
+void write_png_file(char *file_name, Png *image, EncoderSettings *settings) {
+    png_structp png_ptr;
+    png_infop info_ptr;
+    PngOutput output;
+    open_png_writer(file_name, image, &png_ptr, &info_ptr, settings, &output);
 
-    /* Open file */
-    FILE *fp = fopen(file_name, "wb");
-    if (!fp) {
-        printf("Error: Can not create file: %s\n", file_name);
-        exit(ERR_FILE_WRITE_ERROR);
+    /* Errors raised while the image is written drop the output, so a failed run leaves no file behind */
+    jmp_buf recovery;
+    jmp_buf *outer_recovery = get_error_recovery();
+    int code = setjmp(recovery);
+    if (code != 0) {
+        set_error_recovery(outer_recovery);
+        close_png_output(&output, 0);
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        raise_error(code);
     }
+    set_error_recovery(&recovery);
 
-    /* Create PNG write structure */
-    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (!png_ptr) {
-        printf("Error: Can not create PNG write struct\n");
-        fclose(fp);
-        exit(ERR_FILE_WRITE_ERROR);
+    /* Write image data, compressing strips of rows in parallel when threads are free */
+    int parallel = write_png_rows_parallel(png_ptr, image, settings);
+
+    /* Handle errors, the parallel encoder handled its own */
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        printf("Error: Unknown\n");
+        raise_error(ERR_FILE_WRITE_ERROR);
     }
 
-    /* Create PNG info structure */
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    if (!info_ptr) {
-        printf("Error: Can not create PNG info struct while writing\n");
-        fclose(fp);
-        png_destroy_write_struct(&png_ptr, NULL);
-        exit(ERR_FILE_WRITE_ERROR);
+    if (parallel) {
+        png_write_chunk(png_ptr, (png_const_bytep)"IEND", NULL, 0);
+    } else {
+        write_png_rows(png_ptr, image, 0, image->height);
+
+        /* Finalize writing */
+        png_write_end(png_ptr, NULL);
     }
 
-    /* Set up error handling */
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        printf("Error: Unknown\n");
-        fclose(fp);
-        png_destroy_write_struct(&png_ptr, &info_ptr);
-        exit(ERR_FILE_WRITE_ERROR);
+    /* Clean up */
+    set_error_recovery(outer_recovery);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    if (!close_png_output(&output, 1)) {
+        printf("Error: Can not write file: %s\n", file_name);
+        raise_error(ERR_FILE_WRITE_ERROR);
     }
+}
 
-    /* Initialize IO */
-    png_init_io(png_ptr, fp);
-    png_set_IHDR(png_ptr, info_ptr, image->width, image->height, image->bit_depth, image->color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
-    png_write_info(png_ptr, info_ptr);
+/**
+ * @brief Copies a PNG file to another one row by row, passing every row through a function on the way.
+ *
+ * @param input_file A string representing the file name/path of the PNG image to be read.
+ * @param output_file A string representing the file name/path where the processed PNG image will be saved.
+ * @param prepare The function called with the header of the image before the first row, NULL if there is nothing to prepare.
+ *                It may set rows_begin and rows_end of the image to a window of rows that process needs.
+ * @param function The function applied to every row outside the window before it is written.
+ * @param process The function applied to the rows of the window once they are all read, NULL if prepare sets no window.
+ * @param context A pointer passed unchanged to prepare, process and every call of function.
+ * @param settings A pointer to the EncoderSettings structure, NULL to keep the libpng defaults.
+ *
+ * @return int 1 if the image was streamed, 0 if the input is interlaced and has to be read as a whole.
+ *
+ * @note Only the window and one row are held in memory, so rows nothing reads across are never stored.
+ */
+int stream_png_file(char *input_file, char *output_file, HeaderFunction prepare, RowFunction function, WindowFunction process, void *context, EncoderSettings *settings) {
+    Png image = {0};
+    png_structp png_ptr;
+    png_infop info_ptr;
+    PngInput input;
+    PngOutput output;
+    open_png_reader(input_file, &image, &input);
+
+    /* Interlaced rows come in several passes, so they can not be written one by one */
+    if (png_get_interlace_type(image.png_ptr, image.info_ptr) != PNG_INTERLACE_NONE) {
+        close_png_input(&input);
+        png_destroy_read_struct(&image.png_ptr, &image.info_ptr, NULL);
+        return 0;
+    }
 
-    /* Write image data */
-    png_write_image(png_ptr, image->row_pointers);
+    /* Errors raised while the image is streamed, by libpng or by the functions, close everything before they go on */
+    jmp_buf recovery;
+    jmp_buf *outer_recovery = get_error_recovery();
+    png_bytep volatile row = NULL;
+    png_structp volatile writer_ptr = NULL;
+    png_infop volatile writer_info_ptr = NULL;
+    int code = setjmp(recovery);
+    if (code != 0) {
+        set_error_recovery(outer_recovery);
+        free(row);
+        free_png_pixels(&image);
+        close_png_input(&input);
+        png_destroy_read_struct(&image.png_ptr, &image.info_ptr, NULL);
+        if (writer_ptr != NULL) {
+            png_ptr = writer_ptr;
+            info_ptr = writer_info_ptr;
+            close_png_output(&output, 0);
+            png_destroy_write_struct(&png_ptr, &info_ptr);
+        }
+        raise_error(code);
+    }
+    set_error_recovery(&recovery);
+
+    if (prepare != NULL) {
+        prepare(&image, context);
+    }
+
+    /* Allocate memory for the window and a single row */
+    size_t row_bytes = png_get_rowbytes(image.png_ptr, image.info_ptr);
+    if (image.rows_begin < image.rows_end) {
+        allocate_png_rows(&image, row_bytes, image.rows_begin, image.rows_end);
+    }
+    void *buffer = NULL;
+    PROFILE_COUNT(allocations, 1);
+    if (posix_memalign(&buffer, PIXEL_ALIGNMENT, row_bytes) != 0) {
+        printf("Error: Can not allocate memory for row while streaming\n");
+        raise_error(ERR_MEMORY_ALLOCATION_FAILURE);
+    }
+    row = buffer;
+
+    open_png_writer(output_file, &image, &png_ptr, &info_ptr, settings, &output);
+    writer_ptr = png_ptr;
+    writer_info_ptr = info_ptr;
 
-    /* Handle errors */
+    /* Set up error handling, the recovery above cleans up */
+    if (setjmp(png_jmpbuf(image.png_ptr))) {
+        printf("Error: Unknown\n");
+        raise_error(ERR_FILE_READ_ERROR);
+    }
     if (setjmp(png_jmpbuf(png_ptr))) {
         printf("Error: Unknown\n");
-        fclose(fp);
-        png_destroy_write_struct(&png_ptr, &info_ptr);
-        exit(ERR_FILE_WRITE_ERROR);
+        raise_error(ERR_FILE_WRITE_ERROR);
+    }
+
+    /* Read, process and write rows one at a time */
+    for (int y = 0; y < image.height; y++) {
+        if (y == image.rows_begin && image.rows_begin < image.rows_end) {
+            /* The rows of the window are read as a whole, processed together and written */
+            read_png_rows(&image, image.rows_begin, image.rows_end);
+            process(&image, context);
+            write_png_rows(png_ptr, &image, image.rows_begin, image.rows_end);
+            y = image.rows_end - 1;
+            continue;
+        }
+        png_read_row(image.png_ptr, row, NULL);
+        PROFILE_COUNT(pixels_visited, image.width);
+        function(&image, row, y, context);
+        png_write_row(png_ptr, row);
     }
 
-    /* Finalize writing */
+    /* Finalize reading and writing */
+    png_read_end(image.png_ptr, NULL);
     png_write_end(png_ptr, NULL);
 
     /* Clean up */
-    fclose(fp);
+    set_error_recovery(outer_recovery);
+    free(row);
+    free_png_pixels(&image);
+    close_png_input(&input);
+    png_destroy_read_struct(&image.png_ptr, &image.info_ptr, NULL);
     png_destroy_write_struct(&png_ptr, &info_ptr);
+    if (!close_png_output(&output, 1)) {
+        printf("Error: Can not write file: %s\n", output_file);
+        raise_error(ERR_FILE_WRITE_ERROR);
+    }
+
+    return 1;
 }
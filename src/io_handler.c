@@ -0,0 +1,364 @@
+/* realpath is part of the X/Open extensions of POSIX. */
+#define _XOPEN_SOURCE 700
+
+#include "errors.h"
+#include "structures.h"
+#include "error_handler.h"
+#include "profile_handler.h"
+#include <errno.h>
+
+/* Size of the output buffer when the encoder settings give none. */
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+
+/* Size of the first block of memory for inputs that can not be mapped. */
+#define READ_BLOCK_SIZE (1024 * 1024)
+
+/* Descriptor the PNG data for '-' is written to, once messages of the program were moved to stderr. */
+static int stdout_fd = -1;
+static pthread_mutex_t stdout_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Keeps stdout for the PNG data and sends everything the program prints to stderr instead.
+ *
+ * This function does not return a value.
+ *
+ * @note Has to be called before anything is printed when the output file is '-', calling it again does nothing.
+ */
+void reserve_stdout() {
+    pthread_mutex_lock(&stdout_mutex);
+    if (stdout_fd < 0) {
+        fflush(stdout);
+        stdout_fd = dup(STDOUT_FILENO);
+        if (stdout_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            pthread_mutex_unlock(&stdout_mutex);
+            printf("Error: Can not redirect messages to stderr\n");
+            raise_error(ERR_FILE_WRITE_ERROR);
+        }
+    }
+    pthread_mutex_unlock(&stdout_mutex);
+}
+
+/**
+ * @brief Reads everything left in a file descriptor into memory.
+ *
+ * @param fd The file descriptor, for example of stdin or a pipe.
+ * @param input A pointer to the PngInput structure to be filled.
+ *
+ * This function does not return a value.
+ */
+static void read_descriptor(int fd, PngInput *input) {
+    size_t capacity = 0;
+    png_bytep data = NULL;
+    ssize_t count;
+
+    input->size = 0;
+    do {
+        if (input->size + READ_BLOCK_SIZE > capacity) {
+            capacity = capacity ? capacity * 2 : READ_BLOCK_SIZE;
+            PROFILE_COUNT(allocations, 1);
+            png_bytep grown = realloc(data, capacity);
+            if (grown == NULL) {
+                free(data);
+                printf("Error: Can not allocate memory for input\n");
+                raise_error(ERR_MEMORY_ALLOCATION_FAILURE);
+            }
+            data = grown;
+        }
+        count = read(fd, data + input->size, capacity - input->size);
+        if (count > 0) {
+            input->size += count;
+        }
+    } while (count > 0);
+
+    if (count < 0) {
+        free(data);
+        printf("Error: Can not read input\n");
+        raise_error(ERR_FILE_READ_ERROR);
+    }
+    input->data = data;
+    input->mapped = 0;
+}
+
+/**
+ * @brief Opens a file for reading a PNG image from memory.
+ *
+ * @param file_name A string representing the file name/path of the PNG image, '-' for stdin.
+ * @param input A pointer to the PngInput structure to be filled.
+ *
+ * This function does not return a value.
+ *
+ * @note Regular files are mapped, so libpng copies straight from the page cache. Anything that can not be mapped, like a pipe, is read into memory.
+ */
+void open_png_input(char *file_name, PngInput *input) {
+    input->position = 0;
+
+    if (strcmp(file_name, "-") == 0) {
+        read_descriptor(STDIN_FILENO, input);
+        return;
+    }
+
+    int fd = open(file_name, O_RDONLY);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        printf("Error: Can not read file %s\n", file_name);
+        raise_error(ERR_FILE_NOT_FOUND);
+    }
+
+    input->size = file_stat.st_size;
+    void *data = MAP_FAILED;
+    if (S_ISREG(file_stat.st_mode) && input->size > 0) {
+        data = mmap(NULL, input->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (data != MAP_FAILED) {
+        /* The whole file is read once from start to end */
+        posix_madvise(data, input->size, POSIX_MADV_SEQUENTIAL);
+        input->data = data;
+        input->mapped = 1;
+    } else {
+        /* Not a regular file, read it like stdin */
+        read_descriptor(fd, input);
+    }
+    close(fd);
+}
+
+/**
+ * @brief Hands libpng the next bytes of the input.
+ *
+ * @param png_ptr The libpng read structure, its io pointer is the PngInput.
+ * @param data The buffer the bytes are copied to.
+ * @param length The number of bytes libpng needs.
+ *
+ * This function does not return a value.
+ */
+static void read_png_input(png_structp png_ptr, png_bytep data, size_t length) {
+    PngInput *input = png_get_io_ptr(png_ptr);
+    if (length > input->size - input->position) {
+        png_error(png_ptr, "Unexpected end of file");
+    }
+    memcpy(data, input->data + input->position, length);
+    input->position += length;
+    PROFILE_COUNT(bytes_read, length);
+}
+
+/**
+ * @brief Makes libpng read from an opened input.
+ *
+ * @param png_ptr The libpng read structure.
+ * @param input A pointer to the opened PngInput structure.
+ *
+ * This function does not return a value.
+ */
+void set_png_input(png_structp png_ptr, PngInput *input) {
+    png_set_read_fn(png_ptr, input, read_png_input);
+}
+
+/**
+ * @brief Unmaps or frees the contents of an input.
+ *
+ * @param input A pointer to the PngInput structure.
+ *
+ * This function does not return a value.
+ */
+void close_png_input(PngInput *input) {
+    if (input->mapped) {
+        munmap((void*)input->data, input->size);
+    } else {
+        free((void*)input->data);
+    }
+    input->data = NULL;
+    input->size = 0;
+}
+
+/**
+ * @brief Opens a file for writing a PNG image through a buffer.
+ *
+ * @param file_name A string representing the file name/path where the PNG image will be saved, '-' for stdout.
+ * @param output A pointer to the PngOutput structure to be filled.
+ * @param buffer_size The size of the buffer in bytes, 0 for the default.
+ *
+ * This function does not return a value.
+ *
+ * @note An existing file is only replaced once the image is complete: a temporary file next to it is written and renamed over it
+ *       when the output is closed. So the output may also be the input, which stays intact while it is read. A symbolic link is
+ *       followed, so the file it points to is replaced and the link stays. A file that did not exist is removed again when the
+ *       output is dropped, so a failed run leaves nothing behind.
+ */
+void open_png_output(char *file_name, PngOutput *output, size_t buffer_size) {
+    output->capacity = buffer_size ? buffer_size : OUTPUT_BUFFER_SIZE;
+    output->filled = 0;
+    output->file_name = NULL;
+    output->target_name = NULL;
+    output->temporary_name = NULL;
+    output->created = 0;
+    PROFILE_COUNT(allocations, 1);
+    output->buffer = malloc(output->capacity);
+    if (output->buffer == NULL) {
+        printf("Error: Can not allocate memory for output buffer\n");
+        raise_error(ERR_MEMORY_ALLOCATION_FAILURE);
+    }
+
+    if (strcmp(file_name, "-") == 0) {
+        reserve_stdout();
+        output->fd = stdout_fd;
+        return;
+    }
+
+    output->file_name = file_name;
+    struct stat file_stat;
+    if (stat(file_name, &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
+        /* Replace an existing file only once it is complete, next to the file a link points to */
+        output->target_name = realpath(file_name, NULL);
+        output->temporary_name = output->target_name ? malloc(strlen(output->target_name) + 8) : NULL;
+        if (output->temporary_name == NULL) {
+            printf("Error: Can not allocate memory for file name\n");
+            free(output->target_name);
+            free(output->buffer);
+            raise_error(ERR_MEMORY_ALLOCATION_FAILURE);
+        }
+        sprintf(output->temporary_name, "%s.XXXXXX", output->target_name);
+        output->fd = mkstemp(output->temporary_name);
+        if (output->fd >= 0) {
+            fchmod(output->fd, file_stat.st_mode & 0777);
+        }
+    } else {
+        /* A new file is removed again if the image is not completed, other files like /dev/null or dangling links are written directly */
+        output->fd = open(file_name, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (output->fd >= 0) {
+            output->created = 1;
+        } else if (errno == EEXIST) {
+            output->fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        }
+    }
+
+    if (output->fd < 0) {
+        printf("Error: Can not create file: %s\n", file_name);
+        free(output->target_name);
+        free(output->temporary_name);
+        free(output->buffer);
+        raise_error(ERR_FILE_WRITE_ERROR);
+    }
+}
+
+/**
+ * @brief Writes out the buffered bytes of an output.
+ *
+ * @param output A pointer to the PngOutput structure.
+ *
+ * @return int 1 on success, 0 if the file could not be written.
+ */
+static int flush_output_buffer(PngOutput *output) {
+    size_t written = 0;
+    while (written < output->filled) {
+        ssize_t count = write(output->fd, output->buffer + written, output->filled - written);
+        if (count < 0) {
+            return 0;
+        }
+        written += count;
+    }
+    PROFILE_COUNT(bytes_written, written);
+    output->filled = 0;
+    return 1;
+}
+
+/**
+ * @brief Adds bytes to the output buffer, writing it out when it is full.
+ *
+ * @param output A pointer to the PngOutput structure.
+ * @param data The bytes to be written.
+ * @param length The number of bytes.
+ *
+ * @return int 1 on success, 0 if the file could not be written.
+ *
+ * @note Writes larger than the buffer skip it.
+ */
+int write_output(PngOutput *output, png_const_bytep data, size_t length) {
+    if (output->filled + length > output->capacity) {
+        if (!flush_output_buffer(output)) {
+            return 0;
+        }
+    }
+    if (length >= output->capacity) {
+        PngOutput direct = *output;
+        direct.buffer = (png_bytep)data;
+        direct.filled = length;
+        return flush_output_buffer(&direct);
+    }
+
+    memcpy(output->buffer + output->filled, data, length);
+    output->filled += length;
+    return 1;
+}
+
+/**
+ * @brief Takes bytes from libpng into the output buffer.
+ *
+ * @param png_ptr The libpng write structure, its io pointer is the PngOutput.
+ * @param data The bytes to be written.
+ * @param length The number of bytes.
+ *
+ * This function does not return a value.
+ */
+static void write_png_output(png_structp png_ptr, png_bytep data, size_t length) {
+    if (!write_output(png_get_io_ptr(png_ptr), data, length)) {
+        png_error(png_ptr, "Write error");
+    }
+}
+
+/**
+ * @brief Does nothing, the buffer is written out when the output is closed.
+ *
+ * @param png_ptr The libpng write structure.
+ */
+static void flush_png_output(png_structp png_ptr) {
+    (void)png_ptr;
+}
+
+/**
+ * @brief Makes libpng write to an opened output.
+ *
+ * @param png_ptr The libpng write structure.
+ * @param output A pointer to the opened PngOutput structure.
+ *
+ * This function does not return a value.
+ */
+void set_png_output(png_structp png_ptr, PngOutput *output) {
+    png_set_write_fn(png_ptr, output, write_png_output, flush_png_output);
+}
+
+/**
+ * @brief Writes out the rest of an output and closes it.
+ *
+ * @param output A pointer to the PngOutput structure.
+ * @param complete 1 if the image was written completely, 0 to drop the output after an error.
+ *
+ * @return int 1 on success, 0 if the file could not be written.
+ */
+int close_png_output(PngOutput *output, int complete) {
+    int success = complete && flush_output_buffer(output);
+
+    if (output->file_name != NULL && close(output->fd) != 0) {
+        success = 0;
+    }
+    if (output->temporary_name != NULL) {
+        if (success && rename(output->temporary_name, output->target_name) != 0) {
+            success = 0;
+        }
+        if (!success) {
+            unlink(output->temporary_name);
+        }
+        free(output->temporary_name);
+        free(output->target_name);
+        output->temporary_name = NULL;
+        output->target_name = NULL;
+    } else if (output->created && !success) {
+        unlink(output->file_name);
+    }
+    output->created = 0;
+
+    free(output->buffer);
+    output->buffer = NULL;
+    return success;
+}
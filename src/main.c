@@ -2,6 +2,13 @@
 #include "task_handler.h"
 #include "file_handler.h"
 #include "preparation_handler.h"
+#include "thread_handler.h"
+#include "storage_handler.h"
+#include "profile_handler.h"
+#include "batch_handler.h"
+#include "io_handler.h"
+#include "arena_handler.h"
+#include "serve_handler.h"
 
 /**
  * @brief Main function to handle command-line arguments and process image tasks.
@@ -18,14 +25,56 @@ int main(int argc, char *argv[]) {
     options.output_file = "out.png";
     /* Parse command-line arguments. */
     handle_arguments(argc, argv, &options);
+    /* Print the help and do nothing else. */
+    if (options.flag_help) {
+        print_help();
+        return EXIT_SUCCESS;
+    }
+    /* PNG data written to stdout must not be mixed with messages. */
+    if (strcmp(options.output_file, "-") == 0) {
+        reserve_stdout();
+    }
+    /* Start worker threads if more than one was requested. */
+    if (options.flag_threads) {
+        init_thread_pool(atoi(options.threads_value));
+    }
+    /* Pixels of larger images are paged through a scratch file. */
+    if (options.flag_memory_limit) {
+        set_memory_limit((size_t)atol(options.memory_limit_value) * 1024 * 1024);
+    }
+    /* Time and count everything from here on. */
+    if (options.flag_profile) {
+        enable_profiling();
+    }
+    /* Requests are served on a socket until the process is stopped. */
+    if (options.flag_serve) {
+        run_server(options.serve_value);
+        return 0;
+    }
+    /* Every image of a manifest is processed in this process. */
+    if (options.flag_batch) {
+        int failed = run_batch(options.batch_value);
+        if (options.flag_profile) {
+            print_profile(NULL, NULL, options.batch_value);
+        }
+        free(options.operations);
+        return failed;
+    }
     /* Initialize Png structure to hold information about the input PNG file. */
-    Png image;
-    /* Read the input PNG file. */
-    read_png_file(options.input_file, &image);
-    /* Process tasks based on the provided options. */
-    task_switcher(options, &image);
-    /* Write the modified image to the output PNG file. */
-    write_png_file(options.output_file, &image);
+    Png image = {0};
+    /* Small allocations of the run are taken from one arena and given back together. */
+    Arena arena = {0};
+    use_arena(&arena);
+    /* Read the input PNG file, process tasks based on the provided options and write the output PNG file. */
+    run_task(options, &image);
+    use_arena(NULL);
+    free_arena(&arena);
+    free_png_pixels(&image);
+    /* The record of the run comes after everything it prints. */
+    if (options.flag_profile) {
+        print_profile(options.input_file, options.flag_info ? NULL : options.output_file, NULL);
+    }
+    free(options.operations);
 
     return 0;
 }
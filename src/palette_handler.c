@@ -0,0 +1,171 @@
+#include "errors.h"
+#include "structures.h"
+#include "error_handler.h"
+#include "io_handler.h"
+#include "preparation_handler.h"
+#include "profile_handler.h"
+
+/* Size in bytes of the length and type fields before the data of a chunk, and of the CRC after it. */
+#define CHUNK_HEADER_SIZE 8
+#define CHUNK_CRC_SIZE 4
+
+/**
+ * @brief Finds the chunk starting at a position of a PNG file held in memory.
+ *
+ * @param input A pointer to the PngInput structure holding the file.
+ * @param position The offset of the chunk in the file.
+ * @param chunk A pointer to the PngChunk structure to be filled.
+ *
+ * @return int 1 if the whole chunk lies inside the file, 0 otherwise.
+ */
+static int read_chunk(const PngInput *input, size_t position, PngChunk *chunk) {
+    if (input->size - position < CHUNK_HEADER_SIZE + CHUNK_CRC_SIZE) {
+        return 0;
+    }
+    chunk->position = position;
+    chunk->length = png_get_uint_32(input->data + position);
+    chunk->type = input->data + position + 4;
+    chunk->data = input->data + position + CHUNK_HEADER_SIZE;
+    return chunk->length <= PNG_UINT_31_MAX && chunk->length <= input->size - position - CHUNK_HEADER_SIZE - CHUNK_CRC_SIZE;
+}
+
+/**
+ * @brief Computes the CRC of a chunk from its type and data.
+ *
+ * @param type The 4 bytes of the chunk type.
+ * @param data The data of the chunk.
+ * @param length The size of data in bytes.
+ *
+ * @return uLong The CRC as it is stored after the data.
+ */
+static uLong chunk_crc(png_const_bytep type, png_const_bytep data, png_uint_32 length) {
+    uLong crc = crc32(0L, type, 4);
+    return crc32(crc, data, length);
+}
+
+/**
+ * @brief Applies color replacements to the entries of a palette.
+ *
+ * @param palette The R, G and B bytes of every entry.
+ * @param entry_count The number of entries.
+ * @param operations The 'color_replace' functions, in the order they have to be applied.
+ * @param operation_count The number of functions in operations.
+ *
+ * @return int 1 if the palette was rewritten, 0 if a new color is already in the palette and the pixels have to be rewritten instead.
+ */
+static int replace_palette_colors(png_bytep palette, int entry_count, Operation *operations, int operation_count) {
+    for (int i = 0; i < operation_count; i++) {
+        int* old_color_values = process_color(operations[i].old_color_value);
+        int* new_color_values = process_color(operations[i].new_color_value);
+        if (!old_color_values || !new_color_values) {
+            printf("Error: Can not process color\n");
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+        }
+        png_byte old_color[3] = {old_color_values[0], old_color_values[1], old_color_values[2]};
+        png_byte new_color[3] = {new_color_values[0], new_color_values[1], new_color_values[2]};
+
+        /* Entries of the new color would be merged with the replaced ones, which only the pixels can tell apart */
+        int has_old = 0;
+        int has_new = 0;
+        for (int entry = 0; entry < entry_count; entry++) {
+            has_old |= memcmp(palette + entry * 3, old_color, 3) == 0;
+            has_new |= memcmp(palette + entry * 3, new_color, 3) == 0;
+        }
+        if (has_old && has_new && memcmp(old_color, new_color, 3) != 0) {
+            return 0;
+        }
+
+        for (int entry = 0; entry < entry_count; entry++) {
+            if (memcmp(palette + entry * 3, old_color, 3) == 0) {
+                memcpy(palette + entry * 3, new_color, 3);
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Replaces colors of an indexed-color PNG file by rewriting its palette, copying every other chunk as it is.
+ *
+ * @param input_file A string representing the file name/path of the PNG image to be read.
+ * @param output_file A string representing the file name/path where the PNG image will be saved, '-' for stdout.
+ * @param operations The 'color_replace' functions, in the order they have to be applied, none of them with a color map.
+ * @param operation_count The number of functions in operations.
+ * @param settings A pointer to the EncoderSettings structure, only the output buffer size is used.
+ *
+ * @return int 1 if the output file was written, 0 if the input is not an indexed-color PNG file or its palette can not be
+ *         rewritten, then nothing was written.
+ *
+ * @note The image data is not decoded, so the time taken does not depend on the size of the image beyond copying the file.
+ *       Only the CRCs of IHDR and PLTE are checked, a damaged file is left to libpng to report.
+ */
+int rewrite_palette(char *input_file, char *output_file, Operation *operations, int operation_count, EncoderSettings *settings) {
+    PngInput input;
+    open_png_input(input_file, &input);
+
+    /* Finding IHDR, which has to come first, and PLTE */
+    PngChunk header, palette_chunk = {0, 0, NULL, NULL};
+    int valid = input.size >= 8 && png_sig_cmp(input.data, 0, 8) == 0
+                && read_chunk(&input, 8, &header) && memcmp(header.type, "IHDR", 4) == 0 && header.length == 13
+                && header.data[9] == PNG_COLOR_TYPE_PALETTE;
+    size_t position = 8;
+    while (valid) {
+        PngChunk chunk;
+        if (!read_chunk(&input, position, &chunk)) {
+            valid = 0;
+            break;
+        }
+        if (memcmp(chunk.type, "PLTE", 4) == 0) {
+            palette_chunk = chunk;
+        }
+        position += CHUNK_HEADER_SIZE + chunk.length + CHUNK_CRC_SIZE;
+        if (memcmp(chunk.type, "IEND", 4) == 0) {
+            break;
+        }
+    }
+    valid = valid && palette_chunk.data != NULL && palette_chunk.length % 3 == 0 && palette_chunk.length <= 256 * 3
+            && chunk_crc(header.type, header.data, header.length) == png_get_uint_32(header.data + header.length)
+            && chunk_crc(palette_chunk.type, palette_chunk.data, palette_chunk.length) == png_get_uint_32(palette_chunk.data + palette_chunk.length);
+
+    /* Wrong colors or an output that can not be created are found before anything is written, the input is closed before the error goes on */
+    jmp_buf recovery;
+    jmp_buf *outer_recovery = get_error_recovery();
+    int code = setjmp(recovery);
+    if (code != 0) {
+        set_error_recovery(outer_recovery);
+        close_png_input(&input);
+        raise_error(code);
+    }
+    set_error_recovery(&recovery);
+
+    png_byte palette[256 * 3];
+    if (valid) {
+        memcpy(palette, palette_chunk.data, palette_chunk.length);
+        valid = replace_palette_colors(palette, palette_chunk.length / 3, operations, operation_count);
+    }
+    if (!valid) {
+        set_error_recovery(outer_recovery);
+        close_png_input(&input);
+        return 0;
+    }
+
+    /* Copying the file up to the end of IEND, with the new palette in place of the old one */
+    PROFILE_COUNT(bytes_read, position);
+    PngOutput output;
+    open_png_output(output_file, &output, settings ? settings->output_buffer_size : 0);
+    set_error_recovery(outer_recovery);
+    size_t palette_end = palette_chunk.position + CHUNK_HEADER_SIZE + palette_chunk.length + CHUNK_CRC_SIZE;
+    png_byte crc[CHUNK_CRC_SIZE];
+    png_save_uint_32(crc, chunk_crc(palette_chunk.type, palette, palette_chunk.length));
+    int written = write_output(&output, input.data, palette_chunk.position + CHUNK_HEADER_SIZE)
+                  && write_output(&output, palette, palette_chunk.length)
+                  && write_output(&output, crc, CHUNK_CRC_SIZE)
+                  && write_output(&output, input.data + palette_end, position - palette_end);
+
+    close_png_input(&input);
+    if (!close_png_output(&output, written)) {
+        printf("Error: Can not write file: %s\n", output_file);
+        raise_error(ERR_FILE_WRITE_ERROR);
+    }
+    return 1;
+}
@@ -0,0 +1,140 @@
+#include "errors.h"
+#include "structures.h"
+#include "error_handler.h"
+#include "task_handler.h"
+#include "preparation_handler.h"
+#include "color_map_handler.h"
+#include "arena_handler.h"
+
+/**
+ * @brief Tells whether a function only needs the row it writes, so it can be fused with its neighbours.
+ * 
+ * @param operation A pointer to the Operation structure.
+ * 
+ * @return int 1 for 'color_replace' and 'ornament', 0 for the functions that read other rows ('copy', 'filled_rects').
+ */
+int is_row_local(Operation *operation) {
+    return operation->type == OPERATION_COLOR_REPLACE || operation->type == OPERATION_ORNAMENT;
+}
+
+/**
+ * @brief Parses the options of a row-local function into a stage.
+ * 
+ * @param operation A pointer to the Operation structure, which must be row-local.
+ * @param image A pointer to the Png structure representing the image, only its header is used.
+ * @param stage A pointer to the PipelineStage structure to be filled.
+ * 
+ * This function does not return a value.
+ */
+static void prepare_stage(Operation *operation, Png *image, PipelineStage *stage) {
+    stage->operation = operation;
+
+    if (operation->type == OPERATION_ORNAMENT) {
+        OrnamentContext *context = arena_alloc(sizeof(OrnamentContext));
+        stage->function = prepare_ornament(image, operation->pattern_value, operation->color_value, operation->thickness_value, operation->count_value, context);
+        stage->context = context;
+    } else if (operation->flag_color_map) {
+        stage->function = color_map_row;
+        stage->context = process_color_map(operation->color_map_value, image->format);
+    } else {
+        ColorReplaceContext *context = arena_alloc(sizeof(ColorReplaceContext));
+        prepare_color_replace(context, image, operation->old_color_value, operation->new_color_value);
+        stage->function = color_replace_row;
+        stage->context = context;
+    }
+}
+
+/**
+ * @brief Prepares the stages of a pipeline fused before the header of the image was known.
+ * 
+ * @param image A pointer to the Png structure representing the image, only its header is used.
+ * @param context A pointer to the Pipeline structure.
+ * 
+ * This function does not return a value.
+ * 
+ * @note Has the signature of a HeaderFunction, so streamed pipelines are prepared once the header is read.
+ */
+void prepare_pipeline(Png *image, void *context) {
+    Pipeline *pipeline = context;
+    for (int i = 0; i < pipeline->stage_count; i++) {
+        if (pipeline->stages[i].function == NULL) {
+            prepare_stage(pipeline->stages[i].operation, image, &pipeline->stages[i]);
+        }
+    }
+}
+
+/**
+ * @brief Fuses the row-local functions at the start of a list into one pipeline.
+ * 
+ * @param operations The functions, in the order they have to be applied.
+ * @param operation_count The number of functions in operations.
+ * @param image A pointer to the Png structure representing the image, only its header is used. NULL if it is not known yet,
+ *              the stages are then prepared by prepare_pipeline.
+ * @param pipeline A pointer to the Pipeline structure to be filled, its stages are taken from the arena of the job.
+ * 
+ * @return int The number of fused functions, 0 if the first function is not row-local.
+ */
+int fuse_operations(Operation *operations, int operation_count, Png *image, Pipeline *pipeline) {
+    int count = 0;
+    while (count < operation_count && is_row_local(&operations[count])) {
+        count++;
+    }
+
+    pipeline->stage_count = 0;
+    pipeline->stages = NULL;
+    if (count == 0) {
+        return 0;
+    }
+
+    pipeline->stages = arena_alloc(sizeof(PipelineStage) * count);
+    for (int i = 0; i < count; i++) {
+        pipeline->stages[i] = (PipelineStage){&operations[i], NULL, NULL};
+        pipeline->stage_count++;
+    }
+    if (image != NULL) {
+        prepare_pipeline(image, pipeline);
+    }
+
+    return count;
+}
+
+/**
+ * @brief Fuses every row-local function of a list into one pipeline, skipping the functions that read other rows.
+ * 
+ * @param operations The functions, in the order they have to be applied.
+ * @param operation_count The number of functions in operations.
+ * @param pipeline A pointer to the Pipeline structure to be filled, its stages are taken from the arena of the job.
+ * 
+ * This function does not return a value.
+ * 
+ * @note The pipeline is right for the rows none of the skipped functions reads or writes. Its stages are prepared by prepare_pipeline.
+ */
+void fuse_row_local_operations(Operation *operations, int operation_count, Pipeline *pipeline) {
+    pipeline->stage_count = 0;
+    pipeline->stages = arena_alloc(sizeof(PipelineStage) * (operation_count > 0 ? operation_count : 1));
+    for (int i = 0; i < operation_count; i++) {
+        if (is_row_local(&operations[i])) {
+            pipeline->stages[pipeline->stage_count++] = (PipelineStage){&operations[i], NULL, NULL};
+        }
+    }
+}
+
+/**
+ * @brief Applies every stage of a pipeline to a single row, one after another.
+ * 
+ * @param image A pointer to the Png structure the row belongs to.
+ * @param row A pointer to the pixel data of the row.
+ * @param y The index of the row in the image.
+ * @param context A pointer to the Pipeline structure.
+ * 
+ * This function does not return a value.
+ * 
+ * @note The row stays in cache between the stages, and the result is the same as running the stages over the whole image one by one,
+ *       as every stage only reads and writes the row it is given.
+ */
+void pipeline_row(Png *image, png_bytep row, int y, void *context) {
+    Pipeline *pipeline = context;
+    for (int i = 0; i < pipeline->stage_count; i++) {
+        pipeline->stages[i].function(image, row, y, pipeline->stages[i].context);
+    }
+}
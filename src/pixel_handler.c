@@ -0,0 +1,162 @@
+#include "structures.h"
+
+/*
+ * Every kernel below is written once as a macro and expanded for every pixel
+ * format, so the pixel size, the size of the color channels and the size of a
+ * channel are constants in the loops and no pixel ever checks its format.
+ */
+
+/**
+ * @brief Defines the kernels of one pixel format.
+ *
+ * @param NAME The suffix of the kernel names.
+ * @param PIXEL_BYTES The size of a pixel in bytes.
+ * @param COLOR_BYTES The size in bytes of the color channels at the start of a pixel.
+ * @param CHANNEL_BYTES The size of a channel in bytes.
+ */
+#define DEFINE_PIXEL_KERNELS(NAME, PIXEL_BYTES, COLOR_BYTES, CHANNEL_BYTES) \
+\
+static int color_replace_##NAME(png_bytep row, int width, const png_byte* old_color, const png_byte* new_color) { \
+    int replaced = 0; \
+    for (int x = 0; x < width; x++, row += PIXEL_BYTES) { \
+        if (memcmp(row, old_color, COLOR_BYTES) == 0) { \
+            memcpy(row, new_color, COLOR_BYTES); \
+            replaced++; \
+        } \
+    } \
+    return replaced; \
+} \
+\
+static int has_zero_channel_##NAME(png_const_bytep pixel) { \
+    for (int c = 0; c < COLOR_BYTES; c += CHANNEL_BYTES) { \
+        if (pixel[c] == 0 && (CHANNEL_BYTES == 1 || pixel[c + CHANNEL_BYTES - 1] == 0)) { \
+            return 1; \
+        } \
+    } \
+    return 0; \
+} \
+\
+static void masked_copy_##NAME(png_bytep destination, png_const_bytep source, int width) { \
+    for (int x = 0; x < width; x++) { \
+        png_const_bytep from = source + (size_t)x * PIXEL_BYTES; \
+        if (!has_zero_channel_##NAME(from)) { \
+            memmove(destination + (size_t)x * PIXEL_BYTES, from, PIXEL_BYTES); \
+        } \
+    } \
+} \
+\
+static void masked_copy_backward_##NAME(png_bytep destination, png_const_bytep source, int width) { \
+    for (int x = width - 1; x >= 0; x--) { \
+        png_const_bytep from = source + (size_t)x * PIXEL_BYTES; \
+        if (!has_zero_channel_##NAME(from)) { \
+            memmove(destination + (size_t)x * PIXEL_BYTES, from, PIXEL_BYTES); \
+        } \
+    } \
+} \
+\
+static void color_match_##NAME(png_const_bytep row, int width, const png_byte* color, const png_byte* pattern, uint64_t* bits) { \
+    int x = 0; \
+    for (; x + 8 <= width; x += 8) { \
+        png_const_bytep group_start = row + (size_t)x * PIXEL_BYTES; \
+        unsigned int group = 0xFF; \
+        if (memcmp(group_start, pattern, 8 * PIXEL_BYTES) != 0) { \
+            group = 0; \
+            for (int i = 0; i < 8; i++) { \
+                group |= (unsigned int)(memcmp(group_start + i * PIXEL_BYTES, color, COLOR_BYTES) == 0) << i; \
+            } \
+        } \
+        bits[x >> 6] |= (uint64_t)group << (x & 63); \
+    } \
+    for (; x < width; x++) { \
+        if (memcmp(row + (size_t)x * PIXEL_BYTES, color, COLOR_BYTES) == 0) { \
+            bits[x >> 6] |= (uint64_t)1 << (x & 63); \
+        } \
+    } \
+}
+
+DEFINE_PIXEL_KERNELS(gray8, 1, 1, 1)
+DEFINE_PIXEL_KERNELS(gray_alpha8, 2, 1, 1)
+DEFINE_PIXEL_KERNELS(rgb8, 3, 3, 1)
+DEFINE_PIXEL_KERNELS(rgba8, 4, 3, 1)
+DEFINE_PIXEL_KERNELS(gray16, 2, 2, 2)
+DEFINE_PIXEL_KERNELS(gray_alpha16, 4, 2, 2)
+DEFINE_PIXEL_KERNELS(rgb16, 6, 6, 2)
+DEFINE_PIXEL_KERNELS(rgba16, 8, 6, 2)
+
+/**
+ * @brief Builds the PixelFormat entry of a format whose kernels were defined with DEFINE_PIXEL_KERNELS.
+ */
+#define PIXEL_FORMAT(NAME, COLOR_TYPE, BIT_DEPTH, CHANNELS, PIXEL_BYTES, COLOR_BYTES) \
+    {COLOR_TYPE, BIT_DEPTH, CHANNELS, PIXEL_BYTES, COLOR_BYTES, color_replace_##NAME, masked_copy_##NAME, masked_copy_backward_##NAME, color_match_##NAME}
+
+/* Every layout of pixels the functions work on. */
+static const PixelFormat pixel_formats[] = {
+    PIXEL_FORMAT(gray8, PNG_COLOR_TYPE_GRAY, 8, 1, 1, 1),
+    PIXEL_FORMAT(gray_alpha8, PNG_COLOR_TYPE_GRAY_ALPHA, 8, 2, 2, 1),
+    PIXEL_FORMAT(rgb8, PNG_COLOR_TYPE_RGB, 8, 3, 3, 3),
+    PIXEL_FORMAT(rgba8, PNG_COLOR_TYPE_RGBA, 8, 4, 4, 3),
+    PIXEL_FORMAT(gray16, PNG_COLOR_TYPE_GRAY, 16, 1, 2, 2),
+    PIXEL_FORMAT(gray_alpha16, PNG_COLOR_TYPE_GRAY_ALPHA, 16, 2, 4, 2),
+    PIXEL_FORMAT(rgb16, PNG_COLOR_TYPE_RGB, 16, 3, 6, 6),
+    PIXEL_FORMAT(rgba16, PNG_COLOR_TYPE_RGBA, 16, 4, 8, 6),
+};
+
+/**
+ * @brief Sets the pixel format of an image.
+ *
+ * @param image A pointer to the Png structure.
+ * @param color_type The libpng color type of the pixels in memory.
+ * @param bit_depth The bit depth of the pixels in memory.
+ *
+ * @return int 1 on success, 0 if the format is not supported.
+ */
+int set_pixel_format(Png *image, png_byte color_type, png_byte bit_depth) {
+    for (size_t i = 0; i < sizeof(pixel_formats) / sizeof(pixel_formats[0]); i++) {
+        const PixelFormat *format = &pixel_formats[i];
+        if (format->color_type == color_type && format->bit_depth == bit_depth) {
+            image->format = format;
+            image->channels = format->channels;
+            image->pixel_bytes = format->pixel_bytes;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Converts a color given as 8-bit R, G and B values into a pixel of the given format.
+ *
+ * @param format A pointer to the PixelFormat of the pixel.
+ * @param color_values Array containing the RGB values of the color.
+ * @param pixel The buffer of format->pixel_bytes bytes the pixel is written to.
+ *
+ * This function does not return a value.
+ *
+ * @note Gray formats take the luma of the color (ITU-R BT.601), 16-bit formats scale every value by 257 so that
+ *       255 becomes 65535, and alpha is set to opaque.
+ */
+void encode_color(const PixelFormat *format, const int *color_values, png_bytep pixel) {
+    int values[4];
+    int count = 0;
+
+    if (format->color_type == PNG_COLOR_TYPE_GRAY || format->color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
+        values[count++] = (299 * color_values[0] + 587 * color_values[1] + 114 * color_values[2] + 500) / 1000;
+    } else {
+        values[count++] = color_values[0];
+        values[count++] = color_values[1];
+        values[count++] = color_values[2];
+    }
+    if (format->channels > count) {
+        values[count++] = 255;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (format->bit_depth == 16) {
+            /* Channels are stored big-endian, as in the file */
+            pixel[i * 2] = values[i];
+            pixel[i * 2 + 1] = values[i];
+        } else {
+            pixel[i] = values[i];
+        }
+    }
+}
@@ -1,12 +1,209 @@
 #include "errors.h"
 #include "structures.h"
 #include "task_handler.h"
+#include "color_map_handler.h"
+#include "pixel_handler.h"
+#include "error_handler.h"
+#include "arena_handler.h"
+
+/**
+ * @brief Appends a function to the pipeline of the options.
+ * 
+ * @param options A pointer to the Options structure the function is added to.
+ * @param type The function to be added.
+ * 
+ * This function does not return a value.
+ * 
+ * @note The options given after a function belong to it, until the next function is given.
+ */
+static void add_operation(Options *options, OperationType type) {
+    Operation *operations = realloc(options->operations, sizeof(Operation) * (options->operation_count + 1));
+    if (operations == NULL) {
+        printf("Error: Can not allocate memory for functions\n");
+        raise_error(ERR_MEMORY_ALLOCATION_FAILURE);
+    }
+    options->operations = operations;
+    options->operations[options->operation_count++] = (Operation){.type = type};
+}
+
+/**
+ * @brief Checks that a function of the pipeline has all the options it needs.
+ * 
+ * @param operation A pointer to the Operation structure to be checked, the defaults of the 'circle' pattern are filled in.
+ * 
+ * This function does not return a value.
+ */
+static void check_operation(Operation *operation) {
+    switch (operation->type) {
+        case OPERATION_COPY:
+            /* Not enough arguments for --copy */
+            if (!operation->flag_left_up || !operation->flag_right_down || !operation->flag_dest_left_up) {
+                printf("Error: Insufficient arguments for --copy\n");
+                raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+            }
+            break;
+        case OPERATION_COLOR_REPLACE:
+            /* Not enough arguments for --color_replace */
+            if (!operation->flag_color_map && (!operation->flag_old_color || !operation->flag_new_color)) {
+                printf("Error: Insufficient arguments for --color_replace\n");
+                raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+            }
+
+            /* Both a single pair and a color map for --color_replace */
+            if (operation->flag_color_map && (operation->flag_old_color || operation->flag_new_color)) {
+                printf("Error: --color_map cannot be used together with --old_color or --new_color\n");
+                raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+            }
+            break;
+        case OPERATION_ORNAMENT:
+            /* Not enough arguments for --ornament */
+            if (!operation->flag_pattern || !operation->flag_color) {
+                printf("Error: Insufficient arguments for --ornament\n");
+                raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+            }
+            if (strcmp("rectangle", operation->pattern_value) == 0 || strcmp("semicircles", operation->pattern_value) == 0) {
+                if (!operation->flag_thickness || !operation->flag_count) {
+                    printf("Error: Insufficient arguments for --ornament\n");
+                    raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+                }
+            }
+            else if (strcmp("circle", operation->pattern_value) == 0) {
+                operation->count_value = "1";
+                operation->thickness_value = "1";
+            }
+            break;
+        case OPERATION_FILLED_RECTS:
+            /* Not enough arguments for --filled_rects */
+            if (!operation->flag_border_color || !operation->flag_color || !operation->flag_thickness) {
+                printf("Error: Insufficient arguments for --filled_rects\n");
+                raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+            }
+            break;
+    }
+}
+
+/**
+ * @brief Fills encoder settings with one of the named presets.
+ * 
+ * @param preset The name of the preset: "fast", "balanced" or "small".
+ * @param settings A pointer to the EncoderSettings structure to be filled.
+ * 
+ * @return int 1 if the preset exists, 0 otherwise.
+ * 
+ * @note "fast" suits intermediate files, "balanced" is close to the libpng defaults, "small" spends time for the smallest output.
+ */
+int process_encode_preset(char* preset, EncoderSettings *settings) {
+    if (strcmp(preset, "fast") == 0) {
+        *settings = (EncoderSettings){1, Z_RLE, PNG_FILTER_SUB, 256 * 1024, 0};
+    } else if (strcmp(preset, "balanced") == 0) {
+        *settings = (EncoderSettings){6, Z_DEFAULT_STRATEGY, PNG_ALL_FILTERS, 64 * 1024, 0};
+    } else if (strcmp(preset, "small") == 0) {
+        *settings = (EncoderSettings){9, Z_FILTERED, PNG_ALL_FILTERS, 64 * 1024, 0};
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Builds the encoder settings from the preset and the single encoder options, which take precedence over the preset.
+ * 
+ * @param options A pointer to the Options structure whose encoder settings are filled.
+ * 
+ * This function does not return a value.
+ */
+static void process_encoder_settings(Options *options) {
+    EncoderSettings settings = {-1, -1, -1, 0, 0};
+
+    if (options->flag_encode && !process_encode_preset(options->encode_value, &settings)) {
+        printf("Error: Unknown encoder preset, use fast, balanced or small\n");
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+    }
+
+    if (options->flag_compression_level) {
+        char *end;
+        settings.compression_level = strtol(options->compression_level_value, &end, 10);
+        if (*end != '\0' || end == options->compression_level_value || settings.compression_level < 0 || settings.compression_level > 9) {
+            printf("Error: Compression level is not an integer from 0 to 9\n");
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+        }
+    }
+
+    if (options->flag_strategy) {
+        const char *names[] = {"default", "filtered", "huffman", "rle", "fixed"};
+        const int strategies[] = {Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED};
+        settings.strategy = -1;
+        for (int i = 0; i < 5; i++) {
+            if (strcmp(options->strategy_value, names[i]) == 0) {
+                settings.strategy = strategies[i];
+            }
+        }
+        if (settings.strategy < 0) {
+            printf("Error: Unknown strategy, use default, filtered, huffman, rle or fixed\n");
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+        }
+    }
+
+    if (options->flag_filters) {
+        const char *names[] = {"none", "sub", "up", "avg", "paeth", "all"};
+        const int filters[] = {PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH, PNG_ALL_FILTERS};
+        char *copy = arena_alloc(strlen(options->filters_value) + 1);
+        strcpy(copy, options->filters_value);
+
+        settings.filters = 0;
+        char *save;
+        for (char *token = strtok_r(copy, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+            int found = 0;
+            for (int i = 0; i < 6; i++) {
+                if (strcmp(token, names[i]) == 0) {
+                    settings.filters |= filters[i];
+                    found = 1;
+                }
+            }
+            if (!found) {
+                printf("Error: Unknown filter %s, use none, sub, up, avg, paeth or all\n", token);
+                raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+            }
+        }
+
+        if (settings.filters == 0) {
+            printf("Error: No filters provided\n");
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+        }
+    }
+
+    if (options->flag_buffer_size) {
+        char *end;
+        long size = strtol(options->buffer_size_value, &end, 10);
+        if (*end != '\0' || end == options->buffer_size_value || size <= 0) {
+            printf("Error: Buffer size is not a positive integer\n");
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+        }
+        settings.buffer_size = size;
+    }
+
+    if (options->flag_output_buffer_size) {
+        char *end;
+        long size = strtol(options->output_buffer_size_value, &end, 10);
+        if (*end != '\0' || end == options->output_buffer_size_value || size <= 0) {
+            printf("Error: Output buffer size is not a positive integer\n");
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+        }
+        settings.output_buffer_size = size;
+    }
+
+    options->encoder = settings;
+}
+
 /**
  * @brief Handles command-line arguments passed to the program and populates the Options structure accordingly.
  * 
  * @param argc An integer representing the number of command-line arguments.
  * @param argv An array of strings containing the command-line arguments.
  * @param options A pointer to the Options structure where the parsed arguments will be stored.
+ * 
+ * @note Wrong arguments raise ERR_INSUFFICIENT_ARGUMENTS, so requests of --serve can be rejected without ending the server.
+ *       For -h or no arguments only flag_help is set, the help is printed by the caller.
  */
 void handle_arguments(int argc, char *argv[], Options *options) {
     opterr = 0;
@@ -31,6 +228,18 @@ void handle_arguments(int argc, char *argv[], Options *options) {
         {"count", required_argument, NULL, 268},
         {"border_color", required_argument, NULL, 269},
         {"info", no_argument, NULL, 270},
+        {"color_map", required_argument, NULL, 271},
+        {"threads", required_argument, NULL, 272},
+        {"batch", required_argument, NULL, 273},
+        {"compression_level", required_argument, NULL, 274},
+        {"strategy", required_argument, NULL, 275},
+        {"filters", required_argument, NULL, 276},
+        {"buffer_size", required_argument, NULL, 277},
+        {"encode", required_argument, NULL, 278},
+        {"output_buffer_size", required_argument, NULL, 279},
+        {"memory_limit", required_argument, NULL, 280},
+        {"profile", no_argument, NULL, 281},
+        {"serve", required_argument, NULL, 282},
         {NULL, 0, NULL, 0}
     };
 
@@ -38,17 +247,16 @@ void handle_arguments(int argc, char *argv[], Options *options) {
 
     if (argc == 1) {
         options->flag_help = 1;
-        print_help();
-        exit(EXIT_SUCCESS);
         return;
     }
 
     while ((res = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+        Operation *operation = options->operation_count ? &options->operations[options->operation_count - 1] : NULL;
         switch (res) {
             case 'h': /* -h ot --help */
                 if (argc != 2) {
                     printf("Too many arguments for --help (-h)\n");
-                    exit(ERR_INSUFFICIENT_ARGUMENTS);
+                    raise_error(ERR_INSUFFICIENT_ARGUMENTS);
                 }
                 options->flag_help = 1;
                 break;
@@ -61,170 +269,218 @@ void handle_arguments(int argc, char *argv[], Options *options) {
                 options->flag_output = 1;
                 break;
             case 256: /* --copy */
-                if (options->flag_info || options->flag_color_replace || options->flag_ornament || options->flag_filled_rects) {
-                    printf("Error: Cannot use more than one function simultaneously\n");
-                    exit(ERR_INSUFFICIENT_ARGUMENTS);
-                }
-                options->flag_copy = 1;
+                add_operation(options, OPERATION_COPY);
                 break;
             case 257: /* --color_replace */
-                if (options->flag_info || options->flag_copy || options->flag_ornament || options->flag_filled_rects) {
-                    printf("Error: Cannot use more than one function simultaneously\n");
-                    exit(ERR_INSUFFICIENT_ARGUMENTS);
-                }
-                options->flag_color_replace = 1;
+                add_operation(options, OPERATION_COLOR_REPLACE);
                 break;
             case 258: /* --ornament */
-                if (options->flag_info || options->flag_copy || options->flag_color_replace || options->flag_filled_rects) {
-                    printf("Error: Cannot use more than one function simultaneously\n");
-                    exit(ERR_INSUFFICIENT_ARGUMENTS);
-                }
-                options->flag_ornament = 1;
+                add_operation(options, OPERATION_ORNAMENT);
                 break;
             case 259: /* --filled_rects */
-                if (options->flag_info || options->flag_copy || options->flag_ornament || options->flag_color_replace) {
-                    printf("Error: Cannot use more than one function simultaneously\n");
-                    exit(ERR_INSUFFICIENT_ARGUMENTS);
-                }
-                options->flag_filled_rects = 1;
+                add_operation(options, OPERATION_FILLED_RECTS);
                 break;
             case 260: /* --left_up */
-                if (!options->flag_copy) {
+                if (!operation || operation->type != OPERATION_COPY) {
                     printf("Error: --copy was not given for --left_up\n");
-                    exit(ERR_INSUFFICIENT_ARGUMENTS);
+                    raise_error(ERR_INSUFFICIENT_ARGUMENTS);
                 }
-                options->left_up_value = optarg;
-                options->flag_left_up = 1;
+                operation->left_up_value = optarg;
+                operation->flag_left_up = 1;
                 break;
             case 261: /* --right_down */
-                if (!options->flag_copy) {
+                if (!operation || operation->type != OPERATION_COPY) {
                     printf("Error: --copy was not given for --right_down\n");
-                    exit(ERR_INSUFFICIENT_ARGUMENTS);
+                    raise_error(ERR_INSUFFICIENT_ARGUMENTS);
                 }
-                options->right_down_value = optarg;
-                options->flag_right_down = 1;
+                operation->right_down_value = optarg;
+                operation->flag_right_down = 1;
                 break;
             case 262: /* --dest_left_up */
-                if (!options->flag_copy) {
+                if (!operation || operation->type != OPERATION_COPY) {
                     printf("Error: --copy was not given for --dest_left_up\n");
-                    exit(ERR_INSUFFICIENT_ARGUMENTS);
+                    raise_error(ERR_INSUFFICIENT_ARGUMENTS);
                 }
-                options->dest_left_up_value = optarg;
-                options->flag_dest_left_up = 1;
+                operation->dest_left_up_value = optarg;
+                operation->flag_dest_left_up = 1;
                 break;
             case 263: /* --old_color */
-                if (!options->flag_color_replace) {
+                if (!operation || operation->type != OPERATION_COLOR_REPLACE) {
                     printf("Error: --color_replace was not given for --old_color\n");
-                    exit(ERR_INSUFFICIENT_ARGUMENTS);
+                    raise_error(ERR_INSUFFICIENT_ARGUMENTS);
                 }
-                options->flag_old_color = 1;
-                options->old_color_value = optarg;
+                operation->flag_old_color = 1;
+                operation->old_color_value = optarg;
                 break;
             case 264: /* --new_color */
-                if (!options->flag_color_replace) {
+                if (!operation || operation->type != OPERATION_COLOR_REPLACE) {
                     printf("Error: --color_replace was not given for --new_color\n");
-                    exit(ERR_INSUFFICIENT_ARGUMENTS);
+                    raise_error(ERR_INSUFFICIENT_ARGUMENTS);
                 }
-                options->flag_new_color = 1;
-                options->new_color_value = optarg;
+                operation->flag_new_color = 1;
+                operation->new_color_value = optarg;
                 break;
             case 265: /* --pattern */
-                if (!options->flag_ornament) {
+                if (!operation || operation->type != OPERATION_ORNAMENT) {
                     printf("Error: --ornament was not given for --pattern\n");
-                    exit(ERR_INSUFFICIENT_ARGUMENTS);
+                    raise_error(ERR_INSUFFICIENT_ARGUMENTS);
                 }
-                options->flag_pattern = 1;
-                options->pattern_value = optarg;
+                operation->flag_pattern = 1;
+                operation->pattern_value = optarg;
                 break;
             case 266: /* --color */
-                if (!options->flag_ornament && !options -> flag_filled_rects) {
+                if (!operation || (operation->type != OPERATION_ORNAMENT && operation->type != OPERATION_FILLED_RECTS)) {
                     printf("Error: --ornament or --filled_rects was not given for --color\n");
-                    exit(ERR_INSUFFICIENT_ARGUMENTS);
+                    raise_error(ERR_INSUFFICIENT_ARGUMENTS);
                 }
-                options->flag_color = 1;
-                options->color_value = optarg;
+                operation->flag_color = 1;
+                operation->color_value = optarg;
                 break;
             case 267: /* --thickness */
-                if (!options->flag_ornament && !options -> flag_filled_rects) {
+                if (!operation || (operation->type != OPERATION_ORNAMENT && operation->type != OPERATION_FILLED_RECTS)) {
                     printf("Error: --ornament or --filled_rects was not given for --thickness\n");
-                    exit(ERR_INSUFFICIENT_ARGUMENTS);
+                    raise_error(ERR_INSUFFICIENT_ARGUMENTS);
                 }
-                options->flag_thickness = 1;
-                options->thickness_value = optarg;
+                operation->flag_thickness = 1;
+                operation->thickness_value = optarg;
                 break;
             case 268: /* --count */
-                if (!options->flag_ornament) {
+                if (!operation || operation->type != OPERATION_ORNAMENT) {
                     printf("Error: --ornament was not given for --count\n");
-                    exit(ERR_INSUFFICIENT_ARGUMENTS);
+                    raise_error(ERR_INSUFFICIENT_ARGUMENTS);
                 }
-                options->flag_count = 1;
-                options->count_value = optarg;
+                operation->flag_count = 1;
+                operation->count_value = optarg;
                 break;
             case 269: /* --border_color */
-                if (!options->flag_filled_rects) {
+                if (!operation || operation->type != OPERATION_FILLED_RECTS) {
                     printf("Error: --filled_rects was not given for --border_color\n");
-                    exit(ERR_INSUFFICIENT_ARGUMENTS);
+                    raise_error(ERR_INSUFFICIENT_ARGUMENTS);
                 }
-                options->flag_border_color = 1;
-                options->border_color_value = optarg;
+                operation->flag_border_color = 1;
+                operation->border_color_value = optarg;
                 break;
             case 270: /* --info */
                 options->flag_info = 1;
                 break;
+            case 271: /* --color_map */
+                if (!operation || operation->type != OPERATION_COLOR_REPLACE) {
+                    printf("Error: --color_replace was not given for --color_map\n");
+                    raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+                }
+                operation->flag_color_map = 1;
+                operation->color_map_value = optarg;
+                break;
+            case 272: /* --threads */
+                options->flag_threads = 1;
+                options->threads_value = optarg;
+                break;
+            case 273: /* --batch */
+                options->flag_batch = 1;
+                options->batch_value = optarg;
+                break;
+            case 274: /* --compression_level */
+                options->flag_compression_level = 1;
+                options->compression_level_value = optarg;
+                break;
+            case 275: /* --strategy */
+                options->flag_strategy = 1;
+                options->strategy_value = optarg;
+                break;
+            case 276: /* --filters */
+                options->flag_filters = 1;
+                options->filters_value = optarg;
+                break;
+            case 277: /* --buffer_size */
+                options->flag_buffer_size = 1;
+                options->buffer_size_value = optarg;
+                break;
+            case 278: /* --encode */
+                options->flag_encode = 1;
+                options->encode_value = optarg;
+                break;
+            case 279: /* --output_buffer_size */
+                options->flag_output_buffer_size = 1;
+                options->output_buffer_size_value = optarg;
+                break;
+            case 280: /* --memory_limit */
+                options->flag_memory_limit = 1;
+                options->memory_limit_value = optarg;
+                break;
+            case 281: /* --profile */
+                options->flag_profile = 1;
+                break;
+            case 282: /* --serve */
+                options->flag_serve = 1;
+                options->serve_value = optarg;
+                break;
             case '?':
             default:
                 printf("Error: Unknown option or missing argument\n");
-                exit(ERR_INSUFFICIENT_ARGUMENTS);
+                raise_error(ERR_INSUFFICIENT_ARGUMENTS);
                 break;
         }
     }
 
-    /* No function provided */
-    if (!options->flag_info && !options->flag_help && !options->flag_copy && !options->flag_color_replace && !options->flag_ornament && !options->flag_filled_rects) {
-        printf("Error: No function provided\n");
-        exit(ERR_INSUFFICIENT_ARGUMENTS);
+    /* Wrong value for --threads */
+    if (options->flag_threads && atoi(options->threads_value) <= 0) {
+        printf("Error: Number of threads is not a positive integer\n");
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
     }
 
-    /* -h or --help */
-    if (options->flag_help) {
-        print_help();
-        exit(EXIT_SUCCESS);
+    /* Wrong value for --memory_limit */
+    if (options->flag_memory_limit && atol(options->memory_limit_value) <= 0) {
+        printf("Error: Memory limit is not a positive integer\n");
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
     }
 
-    /* Not enough arguments for --copy */
-    if (options->flag_copy && (!options->flag_left_up || !options->flag_right_down || !options->flag_dest_left_up)) {
-        printf("Error: Insufficient arguments for --copy\n");
-        exit(ERR_INSUFFICIENT_ARGUMENTS);
+#ifdef NO_PROFILE
+    /* The profiling hooks were left out of the build */
+    if (options->flag_profile) {
+        printf("Error: Profiling is not built in, rebuild without PROFILE=0\n");
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
     }
+#endif
 
-    /* Not enough arguments for --color_replace */
-    if (options->flag_color_replace && (!options->flag_old_color || !options->flag_new_color)) {
-        printf("Error: Insufficient arguments for --color_replace\n");
-        exit(ERR_INSUFFICIENT_ARGUMENTS);
-    }
+    process_encoder_settings(options);
 
-    /* Not enough arguments for --ornament */
-    if (options->flag_ornament) {
-        if (!options->flag_pattern || !options->flag_color) {
-            printf("Error: Insufficient arguments for --ornament\n");
-            exit(ERR_INSUFFICIENT_ARGUMENTS);
+    /* Functions and files of --serve come with every request */
+    if (options->flag_serve) {
+        if (options->flag_batch || options->flag_profile || options->flag_info || options->operation_count || options->flag_input || options->flag_output || optind < argc) {
+            printf("Error: --serve cannot be used with --batch, --profile, a function or files\n");
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
         }
-        if (strcmp("rectangle", options->pattern_value) == 0 || strcmp("semicircles", options->pattern_value) == 0) {
-            if (!options->flag_thickness || !options->flag_count) {
-                printf("Error: Insufficient arguments for --ornament\n");
-                exit(ERR_INSUFFICIENT_ARGUMENTS);
-            }
-        }
-        else if (strcmp("circle", options->pattern_value) == 0) {
-            options->count_value = "1";
-            options->thickness_value = "1";
+        return;
+    }
+
+    /* Functions and files of --batch come from the manifest */
+    if (options->flag_batch) {
+        if (options->flag_info || options->operation_count || options->flag_input || options->flag_output || optind < argc) {
+            printf("Error: --batch cannot be used with a function or files\n");
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
         }
+        return;
+    }
+
+    /* No function provided */
+    if (!options->flag_info && !options->flag_help && !options->operation_count) {
+        printf("Error: No function provided\n");
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+    }
+
+    /* -h or --help, the caller prints the help */
+    if (options->flag_help) {
+        return;
+    }
+
+    /* --info prints the input as it is */
+    if (options->flag_info && options->operation_count) {
+        printf("Error: Cannot use --info together with a function\n");
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
     }
 
-    /* Not enough arguments for --filled_rects */
-    if (options->flag_filled_rects && (!options->flag_border_color || !options->flag_color || !options->flag_thickness)) {
-        printf("Error: Insufficient arguments for --filled_rects\n");
-        exit(ERR_INSUFFICIENT_ARGUMENTS);
+    for (int i = 0; i < options->operation_count; i++) {
+        check_operation(&options->operations[i]);
     }
 
     /* Getting last argument (input file) or checking too many arguments */
@@ -233,31 +489,25 @@ void handle_arguments(int argc, char *argv[], Options *options) {
             options->input_file = argv[argc - 1];
         } else if (optind < argc - 1) {
             printf("Error: Too many arguments\n");
-            exit(ERR_INSUFFICIENT_ARGUMENTS);
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
         } else {
             printf("Error: No input file provided\n");
-            exit(ERR_INSUFFICIENT_ARGUMENTS);
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
         }
     } else {
         if (optind <= argc - 1) {
             printf("Error: Too many arguments\n");
-            exit(ERR_INSUFFICIENT_ARGUMENTS);
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
         }
     }
-
-    /* Input file has the same name as output file */
-    if (strcmp(options->input_file, options->output_file) == 0) {
-        printf("Error: Input and output files cannot have the same name\n");
-        exit(ERR_INSUFFICIENT_ARGUMENTS);
-    }
 }
 
 /**
  * @brief Processes color provided as a string and returns it as an integer array.
  * 
  * @param string_color A string representing color in the format "R.G.B".
- * @return int* An integer array containing the red, green, and blue components of the color.
- *              NULL if the input string is invalid or if memory allocation fails.
+ * @return int* An integer array containing the red, green, and blue components of the color, taken from the arena of the job.
+ *              NULL if the input string is invalid.
  */
 int* process_color(char* string_color) {
     /* Takes color as "255.0.0" and returns as {255, 0, 0} */
@@ -268,15 +518,15 @@ int* process_color(char* string_color) {
         return NULL;
     }
 
-    char *token = strtok(string_color, ".");
-    int *arr = malloc(sizeof(int)*3);
-    if (arr == NULL) {
-        printf("Error: Can not allocate memory for array of colors\n");
-        exit(ERR_MEMORY_ALLOCATION_FAILURE);
-    }
+    /* Tokenizing a copy keeps the argument intact for later calls */
+    char *copy = arena_alloc(strlen(string_color) + 1);
+    strcpy(copy, string_color);
+    char *save;
+    char *token = strtok_r(copy, ".", &save);
+    int *arr = arena_alloc(sizeof(int)*3);
     while (token != NULL && index < 3) {
         arr[index++] = atoi(token);
-        token = strtok(NULL, ".");
+        token = strtok_r(NULL, ".", &save);
     }
 
     /* If there are less than 3 numbers or one of them are invalid */
@@ -291,8 +541,8 @@ int* process_color(char* string_color) {
  * @brief Processes coordinates provided as a string and returns them as an integer array.
  * 
  * @param string_coordinates A string representing coordinates in the format "X.Y".
- * @return int* An integer array containing the X and Y coordinates.
- *              NULL if the input string is invalid or if memory allocation fails.
+ * @return int* An integer array containing the X and Y coordinates, taken from the arena of the job.
+ *              NULL if the input string is invalid.
  */
 int* process_coordinates(char* string_coordinates){
     /* Takes coordinates as "100.200" and returns as {100, 200} */
@@ -303,15 +553,15 @@ int* process_coordinates(char* string_coordinates){
         return NULL;
     }
 
-    char *token = strtok(string_coordinates, ".");
-    int *arr = malloc(sizeof(int)*2);
-    if (arr == NULL) {
-        printf("Error: Can not allocate memory for array of coordinates\n");
-        exit(ERR_MEMORY_ALLOCATION_FAILURE);
-    }
+    /* Tokenizing a copy keeps the argument intact for later calls */
+    char *copy = arena_alloc(strlen(string_coordinates) + 1);
+    strcpy(copy, string_coordinates);
+    char *save;
+    char *token = strtok_r(copy, ".", &save);
+    int *arr = arena_alloc(sizeof(int)*2);
     while (token != NULL && index < 2) {
         arr[index++] = atoi(token);
-        token = strtok(NULL, ".");
+        token = strtok_r(NULL, ".", &save);
     }
 
     /* If there are less than 2 numbers */
@@ -321,3 +571,102 @@ int* process_coordinates(char* string_coordinates){
 
     return arr;
 }
+
+
+/**
+ * @brief Reads a file of color pairs and returns them as a color map.
+ * 
+ * @param file_name A string representing the file name/path of the color map.
+ * @param format A pointer to the PixelFormat of the image the colors are converted to.
+ * @return ColorMap* A pointer to the ColorMap structure holding every old-to-new pair of the file.
+ * 
+ * @note Every non-empty line of the file holds two colors "R.G.B R.G.B", the old one first.
+ *       Everything after '#' is a comment. An old color may appear only once, for gray images
+ *       this holds for its gray value.
+ */
+ColorMap* process_color_map(char* file_name, const PixelFormat *format) {
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_number = 0;
+    size_t pair_count = 0;
+
+    FILE *fp = fopen(file_name, "r");
+    if (!fp) {
+        printf("Error: Can not read file %s\n", file_name);
+        raise_error(ERR_FILE_NOT_FOUND);
+    }
+
+    /* Wrong lines end a job of --batch or --serve, not the process, so the file is closed before the error goes on */
+    jmp_buf recovery;
+    jmp_buf *outer_recovery = get_error_recovery();
+    char *volatile read_line = NULL;
+    int code = setjmp(recovery);
+    if (code != 0) {
+        set_error_recovery(outer_recovery);
+        free(read_line);
+        fclose(fp);
+        raise_error(code);
+    }
+    set_error_recovery(&recovery);
+
+    /* Count lines first to size the table once, lines of any length are read whole */
+    while (getline(&line, &line_size, fp) != -1) {
+        pair_count++;
+    }
+    read_line = line;
+    rewind(fp);
+
+    ColorMap *map = create_color_map(pair_count, format);
+
+    while (getline(&line, &line_size, fp) != -1) {
+        read_line = line;
+        line_number++;
+
+        /* Cutting off comments */
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        char *save;
+        char *old_string = strtok_r(line, " \t\r\n", &save);
+        if (old_string == NULL) {
+            continue;
+        }
+        char *new_string = strtok_r(NULL, " \t\r\n", &save);
+        int* old_color_values = NULL;
+        int* new_color_values = NULL;
+        if (new_string != NULL && strtok_r(NULL, " \t\r\n", &save) == NULL) {
+            old_color_values = process_color(old_string);
+            new_color_values = process_color(new_string);
+        }
+
+        /* Error handling */
+        if (!old_color_values || !new_color_values) {
+            printf("Error: Can not process color pair on line %d of %s\n", line_number, file_name);
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+        }
+
+        png_byte old_pixel[MAX_PIXEL_BYTES];
+        png_byte new_pixel[MAX_PIXEL_BYTES];
+        encode_color(format, old_color_values, old_pixel);
+        encode_color(format, new_color_values, new_pixel);
+        uint64_t old_color = pack_color(format, old_pixel);
+        uint64_t new_color = pack_color(format, new_pixel);
+
+        int inserted = color_map_insert(map, old_color, new_color);
+        if (inserted == 0) {
+            printf("Error: Color on line %d of %s is already mapped\n", line_number, file_name);
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+        }
+        if (inserted < 0) {
+            printf("Error: Too many colors on line %d of %s for the color map\n", line_number, file_name);
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+        }
+    }
+
+    set_error_recovery(outer_recovery);
+    free(line);
+    fclose(fp);
+    return map;
+}
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "structures.h"
+#include <time.h>
+#include <sys/resource.h>
+
+/* 1 once --profile was given, the profiling hooks do nothing before. */
+int profiling_enabled = 0;
+
+/* Totals of the run, see the PROFILE_ macros. */
+ProfileCounters profile_counters;
+
+/* Names of the stages in the record, in the order of ProfileStage. */
+static const char *profile_stage_names[PROFILE_STAGE_COUNT] = {"read", "operations", "write", "stream", "palette"};
+
+/**
+ * @brief Starts collecting the profile of the run.
+ *
+ * This function does not return a value.
+ */
+void enable_profiling() {
+    memset(&profile_counters, 0, sizeof(profile_counters));
+    profiling_enabled = 1;
+}
+
+/**
+ * @brief Reads a clock in nanoseconds.
+ *
+ * @param clock The clock, CLOCK_MONOTONIC, CLOCK_PROCESS_CPUTIME_ID or CLOCK_THREAD_CPUTIME_ID.
+ *
+ * @return uint64_t The time in nanoseconds.
+ */
+uint64_t read_clock(clockid_t clock) {
+    struct timespec time;
+    clock_gettime(clock, &time);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/**
+ * @brief Marks the start of a timed stage.
+ *
+ * @param timer A pointer to the ProfileTimer structure to be filled.
+ *
+ * This function does not return a value.
+ */
+void start_profile_timer(ProfileTimer *timer) {
+    timer->wall_ns = read_clock(CLOCK_MONOTONIC);
+    timer->cpu_ns = read_clock(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/**
+ * @brief Adds the time since a timer was started to a stage.
+ *
+ * @param timer A pointer to the ProfileTimer structure filled by start_profile_timer.
+ * @param stage The stage the time is added to.
+ *
+ * This function does not return a value.
+ *
+ * @note Stages of images processed at the same time, like the ones of --batch, add up, so their wall time may exceed the one of the run.
+ */
+void stop_profile_timer(ProfileTimer *timer, ProfileStage stage) {
+    __atomic_fetch_add(&profile_counters.wall_ns[stage], read_clock(CLOCK_MONOTONIC) - timer->wall_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&profile_counters.cpu_ns[stage], read_clock(CLOCK_PROCESS_CPUTIME_ID) - timer->cpu_ns, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Prints a string as a JSON string, with quotes and escapes.
+ *
+ * @param string The string.
+ *
+ * This function does not return a value.
+ */
+static void print_json_string(const char *string) {
+    putchar('"');
+    for (const unsigned char *c = (const unsigned char*)string; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            printf("\\%c", *c);
+        } else if (*c < 0x20) {
+            printf("\\u%04x", *c);
+        } else {
+            putchar(*c);
+        }
+    }
+    putchar('"');
+}
+
+/**
+ * @brief Prints the profile of the run as one line of JSON.
+ *
+ * @param input_file The input file of the run, NULL for --batch.
+ * @param output_file The output file of the run, NULL for --batch or --info.
+ * @param batch_file The manifest of --batch, NULL otherwise.
+ *
+ * This function does not return a value.
+ *
+ * @note Only the stages the run went through are printed. Times are in seconds, the peak resident set size in KiB.
+ */
+void print_profile(char *input_file, char *output_file, char *batch_file) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{");
+    if (batch_file != NULL) {
+        printf("\"batch\": ");
+        print_json_string(batch_file);
+    } else {
+        printf("\"input\": ");
+        print_json_string(input_file);
+        if (output_file != NULL) {
+            printf(", \"output\": ");
+            print_json_string(output_file);
+        }
+    }
+
+    printf(", \"stages\": {");
+    int first = 1;
+    for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++) {
+        if (profile_counters.wall_ns[stage] == 0) {
+            continue;
+        }
+        printf("%s\"%s\": {\"wall_s\": %.6f, \"cpu_s\": %.6f}", first ? "" : ", ", profile_stage_names[stage],
+               profile_counters.wall_ns[stage] / 1e9, profile_counters.cpu_ns[stage] / 1e9);
+        first = 0;
+    }
+    printf("}");
+
+    printf(", \"bytes_read\": %llu, \"bytes_written\": %llu", (unsigned long long)profile_counters.bytes_read,
+           (unsigned long long)profile_counters.bytes_written);
+    printf(", \"pixels_visited\": %llu, \"pixels_modified\": %llu", (unsigned long long)profile_counters.pixels_visited,
+           (unsigned long long)profile_counters.pixels_modified);
+    printf(", \"rects_found\": %llu, \"allocations\": %llu", (unsigned long long)profile_counters.rects_found,
+           (unsigned long long)profile_counters.allocations);
+    printf(", \"arena_bytes\": %llu, \"arena_peak_bytes\": %llu", (unsigned long long)profile_counters.arena_bytes,
+           (unsigned long long)profile_counters.arena_peak_bytes);
+    printf(", \"peak_rss_kib\": %ld}\n", usage.ru_maxrss);
+    fflush(stdout);
+}
@@ -0,0 +1,356 @@
+#include "errors.h"
+#include "structures.h"
+#include "error_handler.h"
+#include "thread_handler.h"
+#include "storage_handler.h"
+#include "profile_handler.h"
+
+/**
+ * @brief Appends a rectangle to the end of a list, growing it when needed.
+ * 
+ * @param list Pointer to the RectList structure.
+ * @param rect The rectangle to be added.
+ * 
+ * This function does not return a value.
+ */
+void add_rect(RectList *list, Rect rect) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        PROFILE_COUNT(allocations, 1);
+        list->rects = realloc(list->rects, sizeof(Rect) * list->capacity);
+        if (list->rects == NULL) {
+            printf("Error: Can not allocate memory for rectangles\n");
+            raise_error(ERR_MEMORY_ALLOCATION_FAILURE);
+        }
+    }
+    list->rects[list->count++] = rect;
+}
+
+/**
+ * @brief Finds the first set bit of a bitmap row at or after a position.
+ * 
+ * @param bits Pointer to the words of the row.
+ * @param from The position to start from.
+ * @param width The number of bits in the row.
+ * @return int The position of the bit, width if there is none.
+ */
+static int next_set_bit(const uint64_t* bits, int from, int width) {
+    if (from >= width) {
+        return width;
+    }
+    int word_index = from >> 6;
+    int word_count = (width + 63) >> 6;
+    uint64_t word = bits[word_index] & (~(uint64_t)0 << (from & 63));
+    while (word == 0) {
+        if (++word_index == word_count) {
+            return width;
+        }
+        word = bits[word_index];
+    }
+    return (word_index << 6) + __builtin_ctzll(word);
+}
+
+/**
+ * @brief Finds the first clear bit of a bitmap row at or after a position.
+ * 
+ * @param bits Pointer to the words of the row.
+ * @param from The position to start from.
+ * @param width The number of bits in the row.
+ * @return int The position of the bit, width if there is none.
+ */
+static int next_clear_bit(const uint64_t* bits, int from, int width) {
+    if (from >= width) {
+        return width;
+    }
+    int word_index = from >> 6;
+    int word_count = (width + 63) >> 6;
+    uint64_t word = ~bits[word_index] & (~(uint64_t)0 << (from & 63));
+    while (word == 0) {
+        if (++word_index == word_count) {
+            return width;
+        }
+        word = ~bits[word_index];
+    }
+    int position = (word_index << 6) + __builtin_ctzll(word);
+    return (position < width) ? position : width;
+}
+
+/**
+ * @brief Builds the mask of the bits from begin to end - 1 inside one word.
+ * 
+ * @param word_index The index of the word in the row.
+ * @param begin The first bit of the range in the row.
+ * @param end The bit after the last one of the range in the row.
+ * @return uint64_t The mask of the bits of the range that fall into the word.
+ */
+static uint64_t range_mask(int word_index, int begin, int end) {
+    int low = (begin > word_index * 64) ? begin - word_index * 64 : 0;
+    int high = (end < word_index * 64 + 64) ? end - word_index * 64 : 64;
+    uint64_t mask = (high == 64) ? ~(uint64_t)0 : (((uint64_t)1 << high) - 1);
+    return mask & (~(uint64_t)0 << low);
+}
+
+/**
+ * @brief Checks whether all bits from begin to end - 1 of a bitmap row are set.
+ * 
+ * @param bits Pointer to the words of the row.
+ * @param begin The first bit of the range.
+ * @param end The bit after the last one of the range.
+ * @return int 1 if all bits are set, 0 otherwise.
+ */
+static int all_bits_set(const uint64_t* bits, int begin, int end) {
+    for (int word_index = begin >> 6; word_index <= (end - 1) >> 6; word_index++) {
+        uint64_t mask = range_mask(word_index, begin, end);
+        if ((bits[word_index] & mask) != mask) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Clears the bits from begin to end - 1 of a bitmap row.
+ * 
+ * @param bits Pointer to the words of the row.
+ * @param begin The first bit of the range.
+ * @param end The bit after the last one of the range.
+ * 
+ * This function does not return a value.
+ */
+static void clear_bits(uint64_t* bits, int begin, int end) {
+    for (int word_index = begin >> 6; word_index <= (end - 1) >> 6; word_index++) {
+        bits[word_index] &= ~range_mask(word_index, begin, end);
+    }
+}
+
+/**
+ * @brief Sets the bits from begin to end - 1 of a bitmap row, except those set in a mask row.
+ * 
+ * @param bits Pointer to the words of the row.
+ * @param except Pointer to the words of the mask row, NULL to set all of them.
+ * @param begin The first bit of the range.
+ * @param end The bit after the last one of the range.
+ * 
+ * This function does not return a value.
+ */
+static void set_bits(uint64_t* bits, const uint64_t* except, int begin, int end) {
+    for (int word_index = begin >> 6; word_index <= (end - 1) >> 6; word_index++) {
+        bits[word_index] |= range_mask(word_index, begin, end) & (except ? ~except[word_index] : ~(uint64_t)0);
+    }
+}
+
+/**
+ * @brief Allocates an empty bitmap with one bit per pixel of the image.
+ * 
+ * @param image A pointer to the Png structure representing the image.
+ * @param bitmap Pointer to the PixelBitmap structure to be filled.
+ * 
+ * This function does not return a value.
+ */
+static void allocate_bitmap(Png *image, PixelBitmap *bitmap) {
+    bitmap->width = image->width;
+    bitmap->height = image->height;
+    bitmap->words_per_row = ((size_t)image->width + 63) / 64;
+    PROFILE_COUNT(allocations, 1);
+    bitmap->bits = calloc(bitmap->words_per_row * image->height, sizeof(uint64_t));
+    if (bitmap->bits == NULL) {
+        printf("Error: Can not allocate memory for rectangles bitmap\n");
+        raise_error(ERR_MEMORY_ALLOCATION_FAILURE);
+    }
+}
+
+/**
+ * @brief Sets the bits of the given rows of a bitmap for the pixels that have the given color, and clears the others.
+ * 
+ * @param image A pointer to the Png structure representing the image.
+ * @param color Pixel of the color, in the format of the image.
+ * @param bitmap Pointer to the PixelBitmap structure.
+ * @param y_begin The first row to be built.
+ * @param y_end The row after the last one to be built.
+ * 
+ * This function does not return a value.
+ */
+static void fill_color_bitmap_rows(Png *image, const png_byte* color, PixelBitmap *bitmap, int y_begin, int y_end) {
+    /* Groups of 8 pixels entirely of the color are matched at once */
+    png_byte pattern[8 * MAX_PIXEL_BYTES];
+    int tile_height = get_tile_height(image);
+    PROFILE_COUNT(pixels_visited, (uint64_t)image->width * (y_end - y_begin));
+    for (int i = 0; i < 8; i++) {
+        memcpy(pattern + i * image->pixel_bytes, color, image->pixel_bytes);
+    }
+
+    for (int y = y_begin; y < y_end; y++) {
+        uint64_t *bits = bitmap->bits + bitmap->words_per_row * y;
+        memset(bits, 0, sizeof(uint64_t) * bitmap->words_per_row);
+        image->format->color_match(image->row_pointers[y], image->width, color, pattern, bits);
+
+        /* Only the bitmap is searched from here on, the pixels are needed again just for the borders */
+        if ((y - y_begin + 1) % tile_height == 0 || y == y_end - 1) {
+            release_rows(image, y - (y - y_begin) % tile_height, y + 1);
+        }
+    }
+}
+
+/**
+ * @brief Builds a bitmap with one bit per pixel, set for the pixels of the given color.
+ * 
+ * @param image A pointer to the Png structure representing the image.
+ * @param color Pixel of the color, in the format of the image.
+ * @param bitmap Pointer to the PixelBitmap structure to be filled.
+ * 
+ * This function does not return a value.
+ */
+void build_color_bitmap(Png *image, const png_byte* color, PixelBitmap *bitmap) {
+    allocate_bitmap(image, bitmap);
+    fill_color_bitmap_rows(image, color, bitmap, 0, image->height);
+}
+
+/**
+ * @brief Grows a rectangle down through the given rows while the next row holds its whole run uncovered, covering it.
+ * 
+ * @param bitmap Pointer to the PixelBitmap structure, with covered pixels cleared.
+ * @param rect Pointer to the rectangle, its y2 is moved down.
+ * @param y_end The row the rectangle may not grow into.
+ * 
+ * This function does not return a value.
+ */
+static void grow_rect(PixelBitmap *bitmap, Rect *rect, int y_end) {
+    while (rect->y2 + 1 < y_end && all_bits_set(bitmap->bits + bitmap->words_per_row * (rect->y2 + 1), rect->x1, rect->x2 + 1)) {
+        rect->y2++;
+        clear_bits(bitmap->bits + bitmap->words_per_row * rect->y2, rect->x1, rect->x2 + 1);
+    }
+}
+
+/**
+ * @brief Applies a border drawn around a rectangle to the bitmap, so the search after it sees the drawn pixels.
+ * 
+ * @param bitmap Pointer to the PixelBitmap structure, with covered pixels cleared.
+ * @param covered Pointer to the PixelBitmap of the covered pixels if the border has the color of the rectangles, NULL otherwise.
+ * @param rect The rectangle the border is drawn around, found at its first row.
+ * @param thickness The thickness of the border.
+ * 
+ * This function does not return a value.
+ * 
+ * @note Rows above the rectangle are never searched again, so only the rows from its first one down are changed.
+ *       A border of another color clears its pixels, one of the same color sets those not covered yet.
+ */
+static void apply_border(PixelBitmap *bitmap, const PixelBitmap *covered, Rect rect, int thickness) {
+    int last_row = (rect.y2 + thickness < bitmap->height - 1) ? rect.y2 + thickness : bitmap->height - 1;
+    int outer_begin = (rect.x1 - thickness > 0) ? rect.x1 - thickness : 0;
+    int outer_end = (rect.x2 + thickness + 1 < bitmap->width) ? rect.x2 + thickness + 1 : bitmap->width;
+
+    for (int y = rect.y1; y <= last_row; y++) {
+        uint64_t *bits = bitmap->bits + bitmap->words_per_row * y;
+        const uint64_t *except = covered ? covered->bits + covered->words_per_row * y : NULL;
+
+        /* Below the rectangle the border is one span of the full outer width, beside it two spans */
+        int spans[2][2] = {{outer_begin, outer_end}, {0, 0}};
+        if (y <= rect.y2) {
+            spans[0][1] = rect.x1;
+            spans[1][0] = rect.x2 + 1;
+            spans[1][1] = outer_end;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (spans[i][0] >= spans[i][1]) {
+                continue;
+            }
+            if (covered) {
+                set_bits(bits, except, spans[i][0], spans[i][1]);
+            } else {
+                clear_bits(bits, spans[i][0], spans[i][1]);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Structure shared by the strips of the bitmap built by find_filled_rects.
+ */
+typedef struct RectStrips {
+    Png *image; /**< The image being searched */
+    const png_byte* color; /**< Pixel of the color of the rectangles, in the format of the image */
+    PixelBitmap bitmap; /**< Bitmap of the color for the whole image */
+    int strip_count; /**< The number of strips the rows are split into */
+} RectStrips;
+
+/**
+ * @brief Builds the bitmap of one strip of rows.
+ * 
+ * @param index The index of the strip.
+ * @param context Pointer to the RectStrips structure.
+ * 
+ * This function does not return a value.
+ */
+static void fill_strip_bitmap(int index, void *context) {
+    RectStrips *strips = context;
+    int y_begin = (int)((long long)strips->image->height * index / strips->strip_count);
+    int y_end = (int)((long long)strips->image->height * (index + 1) / strips->strip_count);
+    fill_color_bitmap_rows(strips->image, strips->color, &strips->bitmap, y_begin, y_end);
+}
+
+/**
+ * @brief Finds all filled rectangles of the given color, in the order they are met scanning the rows from the top,
+ *        as if the border of every one was drawn as soon as it is found.
+ * 
+ * @param image A pointer to the Png structure representing the image, its pixels are not changed.
+ * @param color Pixel of the color of the rectangles, in the format of the image.
+ * @param border_color Pixel of the color of the borders, in the format of the image.
+ * @param border_thickness The thickness of the borders.
+ * @param list Pointer to the RectList structure the rectangles are added to.
+ * 
+ * This function does not return a value.
+ * 
+ * @note A rectangle starts at the first pixel of the color not yet covered, takes the whole uncovered run of the
+ *       color to its right and grows down while the next row holds the same run uncovered. The bitmap of the color
+ *       doubles as the visited map: covered pixels are cleared from it, so one bit per pixel is all that is kept,
+ *       plus a map of the covered pixels when the borders have the color of the rectangles.
+ * 
+ * @note Borders drawn around earlier rectangles can cut or create later ones, so every border is applied to the bitmap
+ *       before the search goes on. The pixels are matched in parallel strips, the search of the bitmap is serial.
+ */
+void find_filled_rects(Png *image, const png_byte* color, const png_byte* border_color, int border_thickness, RectList *list) {
+    RectStrips strips = {image, color, {NULL, 0, 0, 0}, get_thread_count()};
+    if (strips.strip_count > image->height) {
+        strips.strip_count = image->height;
+    }
+    if (strips.strip_count < 1) {
+        return;
+    }
+
+    allocate_bitmap(image, &strips.bitmap);
+    run_parallel(strips.strip_count, fill_strip_bitmap, &strips);
+    PixelBitmap *bitmap = &strips.bitmap;
+
+    /* Borders of the same color make pixels of the color, but never inside a rectangle found before */
+    PixelBitmap covered = {NULL, 0, 0, 0};
+    int same_color = memcmp(color, border_color, image->pixel_bytes) == 0;
+    if (same_color) {
+        allocate_bitmap(image, &covered);
+    }
+
+    for (int y = 0; y < bitmap->height; y++) {
+        uint64_t *bits = bitmap->bits + bitmap->words_per_row * y;
+        int x = next_set_bit(bits, 0, bitmap->width);
+        while (x < bitmap->width) {
+            int end_x = next_clear_bit(bits, x, bitmap->width);
+
+            /* Marking the first row, then finding end vertically */
+            Rect rect = {x, y, end_x - 1, y};
+            clear_bits(bits, x, end_x);
+            grow_rect(bitmap, &rect, bitmap->height);
+            add_rect(list, rect);
+
+            if (same_color) {
+                for (int row = rect.y1; row <= rect.y2; row++) {
+                    set_bits(covered.bits + covered.words_per_row * row, NULL, rect.x1, rect.x2 + 1);
+                }
+            }
+            apply_border(bitmap, same_color ? &covered : NULL, rect, border_thickness);
+
+            x = next_set_bit(bits, end_x, bitmap->width);
+        }
+    }
+
+    free(covered.bits);
+    free(bitmap->bits);
+}
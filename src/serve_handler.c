@@ -0,0 +1,742 @@
+#include "errors.h"
+#include "structures.h"
+#include "error_handler.h"
+#include "preparation_handler.h"
+#include "thread_handler.h"
+#include "arena_handler.h"
+#include "profile_handler.h"
+#include "batch_handler.h"
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Longest request line in bytes, longer lines are refused without being kept. */
+#define MAX_REQUEST_LENGTH (8 * 1024)
+
+/* Largest number of requests waiting for a worker, more are refused until the workers catch up. */
+#define MAX_QUEUED_REQUESTS 256
+
+/* Largest number of clients connected at once, each one has a thread reading its requests. */
+#define MAX_CONNECTIONS 64
+
+/* Socket removed when the server is stopped by a signal. */
+static char *served_socket_path = NULL;
+
+/* getopt keeps its state in globals, so requests are parsed one at a time. */
+static pthread_mutex_t arguments_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Skips the whitespace of a JSON text.
+ *
+ * @param cursor A pointer to the position in the text, moved to the first other character.
+ *
+ * This function does not return a value.
+ */
+static void skip_json_space(char **cursor) {
+    while (**cursor == ' ' || **cursor == '\t' || **cursor == '\r' || **cursor == '\n') {
+        (*cursor)++;
+    }
+}
+
+/**
+ * @brief Reads a JSON string, decoding it in place.
+ *
+ * @param cursor A pointer to the position of the opening quote, moved past the closing quote.
+ *
+ * @return char* The decoded string, NUL-terminated inside the text, NULL if the string is not valid.
+ *
+ * @note The decoded string is never longer than the JSON one, so it ends before the closing quote.
+ */
+static char* read_json_string(char **cursor) {
+    char *read = *cursor;
+    if (*read != '"') {
+        return NULL;
+    }
+    read++;
+
+    char *string = read;
+    char *write = read;
+    while (*read != '"') {
+        if (*read == '\0' || (unsigned char)*read < 0x20) {
+            return NULL;
+        }
+        if (*read != '\\') {
+            *write++ = *read++;
+            continue;
+        }
+
+        read++;
+        switch (*read) {
+            case '"': case '\\': case '/': *write++ = *read; break;
+            case 'b': *write++ = '\b'; break;
+            case 'f': *write++ = '\f'; break;
+            case 'n': *write++ = '\n'; break;
+            case 'r': *write++ = '\r'; break;
+            case 't': *write++ = '\t'; break;
+            case 'u': {
+                /* Characters of the Basic Multilingual Plane, written as UTF-8 */
+                unsigned int code = 0;
+                for (int i = 1; i <= 4; i++) {
+                    char c = read[i];
+                    int digit = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+                    if (digit < 0) {
+                        return NULL;
+                    }
+                    code = code * 16 + digit;
+                }
+                if (code == 0) {
+                    return NULL;
+                }
+                if (code < 0x80) {
+                    *write++ = code;
+                } else if (code < 0x800) {
+                    *write++ = 0xC0 | (code >> 6);
+                    *write++ = 0x80 | (code & 0x3F);
+                } else {
+                    *write++ = 0xE0 | (code >> 12);
+                    *write++ = 0x80 | ((code >> 6) & 0x3F);
+                    *write++ = 0x80 | (code & 0x3F);
+                }
+                read += 4;
+                break;
+            }
+            default:
+                return NULL;
+        }
+        read++;
+    }
+
+    *write = '\0';
+    *cursor = read + 1;
+    return string;
+}
+
+/**
+ * @brief Reads the "id" of a request, a JSON string or number that is echoed in the reply as it is written.
+ *
+ * @param cursor A pointer to the position of the value, moved past it.
+ * @param request A pointer to the ServeRequest structure whose id is set.
+ *
+ * @return int 1 if the value is a string or a number, 0 otherwise.
+ */
+static int read_json_id(char **cursor, ServeRequest *request) {
+    char *start = *cursor;
+    char *end = start;
+    if (*end == '"') {
+        /* Only checked, it is not decoded so the reply can repeat it */
+        end++;
+        while (*end != '"') {
+            if (*end == '\0' || (unsigned char)*end < 0x20) {
+                return 0;
+            }
+            end += (*end == '\\' && end[1] != '\0') ? 2 : 1;
+        }
+        end++;
+    } else {
+        while ((*end >= '0' && *end <= '9') || *end == '-' || *end == '+' || *end == '.' || *end == 'e' || *end == 'E') {
+            end++;
+        }
+        if (end == start) {
+            return 0;
+        }
+    }
+
+    request->id = start;
+    request->id_length = end - start;
+    *cursor = end;
+    return 1;
+}
+
+/**
+ * @brief Parses the JSON line of a request into the arguments of a run.
+ *
+ * @param request A pointer to the ServeRequest structure, whose line is parsed and whose id and arguments are set.
+ *
+ * @return int The number of arguments, 0 if the line is not a valid request.
+ *
+ * @note A request is an object with the strings "input" and "output", the array of strings "args" holding the options
+ *       of the functions as they are given on the command line, and an optional "id". Unknown keys are rejected.
+ */
+static int parse_request(ServeRequest *request) {
+    char *cursor = request->line;
+    char *input = NULL;
+    char *output = NULL;
+
+    /* Every string takes at least two characters, so the line bounds their number */
+    request->arguments = malloc(sizeof(char*) * (strlen(request->line) / 2 + 6));
+    if (request->arguments == NULL) {
+        printf("Error: Can not allocate memory for request\n");
+        return 0;
+    }
+    int count = 1;
+    request->arguments[0] = "cw";
+
+    skip_json_space(&cursor);
+    if (*cursor++ != '{') {
+        return 0;
+    }
+    skip_json_space(&cursor);
+    while (*cursor != '}') {
+        char *key = read_json_string(&cursor);
+        skip_json_space(&cursor);
+        if (key == NULL || *cursor++ != ':') {
+            return 0;
+        }
+        skip_json_space(&cursor);
+
+        if (strcmp(key, "id") == 0) {
+            if (!read_json_id(&cursor, request)) {
+                return 0;
+            }
+        } else if (strcmp(key, "input") == 0) {
+            input = read_json_string(&cursor);
+            if (input == NULL) {
+                return 0;
+            }
+        } else if (strcmp(key, "output") == 0) {
+            output = read_json_string(&cursor);
+            if (output == NULL) {
+                return 0;
+            }
+        } else if (strcmp(key, "args") == 0) {
+            if (*cursor++ != '[') {
+                return 0;
+            }
+            skip_json_space(&cursor);
+            while (*cursor != ']') {
+                char *argument = read_json_string(&cursor);
+                if (argument == NULL) {
+                    return 0;
+                }
+                request->arguments[count++] = argument;
+                skip_json_space(&cursor);
+                if (*cursor == ',') {
+                    cursor++;
+                    skip_json_space(&cursor);
+                } else if (*cursor != ']') {
+                    return 0;
+                }
+            }
+            cursor++;
+        } else {
+            printf("Error: Unknown key %s in request\n", key);
+            return 0;
+        }
+
+        skip_json_space(&cursor);
+        if (*cursor == ',') {
+            cursor++;
+            skip_json_space(&cursor);
+        } else if (*cursor != '}') {
+            return 0;
+        }
+    }
+    cursor++;
+    skip_json_space(&cursor);
+    if (*cursor != '\0' || input == NULL) {
+        return 0;
+    }
+
+    request->arguments[count++] = "-i";
+    request->arguments[count++] = input;
+    if (output != NULL) {
+        request->arguments[count++] = "-o";
+        request->arguments[count++] = output;
+    }
+    request->arguments[count] = NULL;
+    return count;
+}
+
+/**
+ * @brief Checks the options of a request the way the command line of a single run is checked.
+ *
+ * @param request A pointer to the ServeRequest structure, whose arguments are parsed into its options.
+ * @param argument_count The number of arguments.
+ *
+ * @return int 0 if the options are right, the error code raised for them otherwise.
+ */
+static int parse_request_options(ServeRequest *request, int argument_count) {
+    jmp_buf recovery;
+
+    /* What the options are parsed with is not needed afterwards, the arena of the thread would keep it */
+    Arena arena = {0};
+    use_arena(&arena);
+    pthread_mutex_lock(&arguments_mutex);
+    int code = setjmp(recovery);
+    if (code == 0) {
+        set_error_recovery(&recovery);
+
+        /* Same defaults as a single run, getopt starts over for every request */
+        request->options = (Options){NULL};
+        request->options.output_file = "out.png";
+        optind = 0;
+        handle_arguments(argument_count, request->arguments, &request->options);
+
+        /* The process and its output belong to the server */
+        Options *options = &request->options;
+        if (options->flag_help || options->flag_batch || options->flag_serve || options->flag_threads || options->flag_memory_limit || options->flag_profile || options->flag_info) {
+            printf("Error: --help, --batch, --serve, --threads, --memory_limit, --profile and --info cannot be used in a request\n");
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+        }
+        if (strcmp(options->input_file, "-") == 0 || strcmp(options->output_file, "-") == 0) {
+            printf("Error: Standard input and output cannot be used in a request\n");
+            raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+        }
+    }
+    set_error_recovery(NULL);
+    pthread_mutex_unlock(&arguments_mutex);
+    free_arena(&arena);
+    use_arena(NULL);
+
+    return code;
+}
+
+/**
+ * @brief Returns the name of an error code in replies.
+ *
+ * @param code The error code from errors.h.
+ *
+ * @return const char* The name.
+ */
+static const char* get_error_name(int code) {
+    switch (code) {
+        case ERR_FILE_NOT_FOUND:
+            return "file_not_found";
+        case ERR_FILE_READ_ERROR:
+            return "file_read_error";
+        case ERR_FILE_WRITE_ERROR:
+            return "file_write_error";
+        case ERR_FILE_CLOSE_ERROR:
+            return "file_close_error";
+        case ERR_INSUFFICIENT_ARGUMENTS:
+            return "insufficient_arguments";
+        case ERR_MEMORY_ALLOCATION_FAILURE:
+            return "memory_allocation_failure";
+        case ERR_SERVER_BUSY:
+            return "server_busy";
+        case ERR_REQUEST_TOO_LONG:
+            return "request_too_long";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * @brief Sends the reply to a request as one line of JSON.
+ *
+ * @param request A pointer to the ServeRequest structure.
+ * @param code 0 if the request succeeded, the error code it raised otherwise.
+ * @param start_ns Monotonic time the request was started at, in nanoseconds.
+ * @param end_ns Monotonic time the request was finished at, in nanoseconds.
+ * @param cpu_ns CPU time of the thread spent on the request, in nanoseconds.
+ *
+ * This function does not return a value.
+ *
+ * @note A client that went away does not get its reply, the server goes on.
+ */
+static void send_reply(ServeRequest *request, int code, uint64_t start_ns, uint64_t end_ns, uint64_t cpu_ns) {
+    const char *id = (request->id != NULL) ? request->id : "null";
+    int id_length = (request->id != NULL) ? request->id_length : 4;
+    size_t capacity = (size_t)id_length + 256;
+    char *reply = malloc(capacity);
+    if (reply == NULL) {
+        return;
+    }
+
+    int length = snprintf(reply, capacity, "{\"id\": %.*s", id_length, id);
+    if (code == 0) {
+        length += snprintf(reply + length, capacity - length, ", \"status\": \"ok\"");
+    } else {
+        length += snprintf(reply + length, capacity - length, ", \"status\": \"error\", \"code\": %d, \"error\": \"%s\"", code, get_error_name(code));
+    }
+    length += snprintf(reply + length, capacity - length, ", \"queue_s\": %.6f, \"wall_s\": %.6f, \"cpu_s\": %.6f}\n",
+                       (start_ns - request->received_ns) / 1e9, (end_ns - start_ns) / 1e9, cpu_ns / 1e9);
+
+    /* Replies of requests running at the same time must not interleave */
+    ServeConnection *connection = request->connection;
+    pthread_mutex_lock(&connection->mutex);
+    for (int sent = 0; sent < length; ) {
+        ssize_t written = send(connection->fd, reply + sent, length - sent, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            break;
+        }
+        sent += written;
+    }
+    pthread_mutex_unlock(&connection->mutex);
+    free(reply);
+}
+
+/**
+ * @brief Frees a request.
+ *
+ * @param request A pointer to the ServeRequest structure.
+ *
+ * This function does not return a value.
+ */
+static void free_request(ServeRequest *request) {
+    free(request->line);
+    free(request->arguments);
+    free(request->options.operations);
+    free(request);
+}
+
+/**
+ * @brief Drops a holder of a connection, closing and freeing it when it was the last one.
+ *
+ * @param connection A pointer to the ServeConnection structure.
+ *
+ * This function does not return a value.
+ */
+static void release_connection(ServeConnection *connection) {
+    pthread_mutex_lock(&connection->mutex);
+    int last = --connection->references == 0;
+    pthread_mutex_unlock(&connection->mutex);
+
+    if (last) {
+        Server *server = connection->server;
+        pthread_mutex_lock(&server->mutex);
+        server->connection_count--;
+        pthread_mutex_unlock(&server->mutex);
+
+        close(connection->fd);
+        pthread_mutex_destroy(&connection->mutex);
+        free(connection);
+    }
+}
+
+/**
+ * @brief Queues a request for the workers, unless the queue is full.
+ *
+ * @param server A pointer to the Server structure.
+ * @param request A pointer to the ServeRequest structure.
+ *
+ * @return int 1 if the request was queued, 0 if MAX_QUEUED_REQUESTS are already waiting.
+ */
+static int queue_request(Server *server, ServeRequest *request) {
+    pthread_mutex_lock(&server->mutex);
+    if (server->queued_count >= MAX_QUEUED_REQUESTS) {
+        pthread_mutex_unlock(&server->mutex);
+        return 0;
+    }
+    request->next = NULL;
+    if (server->tail != NULL) {
+        server->tail->next = request;
+    } else {
+        server->head = request;
+    }
+    server->tail = request;
+    server->queued_count++;
+    pthread_cond_signal(&server->request_ready);
+    pthread_mutex_unlock(&server->mutex);
+    return 1;
+}
+
+/**
+ * @brief Takes the oldest queued request, waiting for one if there is none.
+ *
+ * @param server A pointer to the Server structure.
+ *
+ * @return ServeRequest* The request.
+ */
+static ServeRequest* take_request(Server *server) {
+    pthread_mutex_lock(&server->mutex);
+    while (server->head == NULL) {
+        pthread_cond_wait(&server->request_ready, &server->mutex);
+    }
+    ServeRequest *request = server->head;
+    server->head = request->next;
+    if (server->head == NULL) {
+        server->tail = NULL;
+    }
+    server->queued_count--;
+    pthread_mutex_unlock(&server->mutex);
+    return request;
+}
+
+/**
+ * @brief Reads the next line of a connection, keeping at most MAX_REQUEST_LENGTH bytes of it.
+ *
+ * @param stream The stream of the connection.
+ * @param line A buffer of MAX_REQUEST_LENGTH + 1 bytes the line is stored in, NUL-terminated and without its newline.
+ *
+ * @return long The length of the line, -1 if the client closed the connection, ERR_REQUEST_TOO_LONG negated if the line
+ *         was longer, then the rest of it was read and dropped.
+ */
+static long read_request_line(FILE *stream, char *line) {
+    size_t length = 0;
+    int too_long = 0;
+    int character;
+    while ((character = getc_unlocked(stream)) != EOF && character != '\n') {
+        if (length < MAX_REQUEST_LENGTH) {
+            line[length++] = character;
+        } else {
+            too_long = 1;
+        }
+    }
+    line[length] = '\0';
+
+    if (too_long) {
+        return -ERR_REQUEST_TOO_LONG;
+    }
+    return (character == EOF && length == 0) ? -1 : (long)length;
+}
+
+/**
+ * @brief Reads the requests of a connection line by line and queues them, until the client closes it.
+ *
+ * @param argument A pointer to the ServeConnection structure.
+ *
+ * @return void* Always NULL.
+ *
+ * @note Wrong requests are answered right away. Requests of one connection may run at the same time,
+ *       so their replies can come in another order, the "id" of a request tells its reply apart.
+ */
+static void* read_requests(void *argument) {
+    ServeConnection *connection = argument;
+    char line[MAX_REQUEST_LENGTH + 1];
+    long length;
+
+    int fd = dup(connection->fd);
+    FILE *stream = fd >= 0 ? fdopen(fd, "r") : NULL;
+    if (stream == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        release_connection(connection);
+        return NULL;
+    }
+
+    while ((length = read_request_line(stream, line)) != -1) {
+        uint64_t received_ns = read_clock(CLOCK_MONOTONIC);
+
+        /* Too long lines are refused without an id, nothing of them is kept */
+        if (length < 0) {
+            printf("Error: Request is longer than %d bytes\n", MAX_REQUEST_LENGTH);
+            ServeRequest refused = {.connection = connection, .received_ns = received_ns};
+            send_reply(&refused, -length, received_ns, received_ns, 0);
+            continue;
+        }
+
+        /* Empty lines keep the connection alive without a reply */
+        char *first = line;
+        skip_json_space(&first);
+        if (*first == '\0') {
+            continue;
+        }
+
+        ServeRequest *request = calloc(1, sizeof(ServeRequest));
+        char *copy = malloc(length + 1);
+        if (request == NULL || copy == NULL) {
+            printf("Error: Can not allocate memory for request\n");
+            free(request);
+            free(copy);
+            break;
+        }
+        memcpy(copy, line, length + 1);
+        request->line = copy;
+        request->connection = connection;
+        request->received_ns = received_ns;
+
+        int argument_count = parse_request(request);
+        int code = (argument_count > 0) ? parse_request_options(request, argument_count) : ERR_INSUFFICIENT_ARGUMENTS;
+        if (argument_count == 0) {
+            printf("Error: Request is not a JSON object with \"input\", \"output\" and \"args\"\n");
+        }
+        if (code != 0) {
+            send_reply(request, code, received_ns, received_ns, 0);
+            free_request(request);
+            continue;
+        }
+
+        pthread_mutex_lock(&connection->mutex);
+        connection->references++;
+        pthread_mutex_unlock(&connection->mutex);
+        if (!queue_request(connection->server, request)) {
+            printf("Error: Request queue is full\n");
+            release_connection(connection);
+            send_reply(request, ERR_SERVER_BUSY, received_ns, received_ns, 0);
+            free_request(request);
+        }
+    }
+
+    fclose(stream);
+    release_connection(connection);
+    return NULL;
+}
+
+/**
+ * @brief Accepts clients and starts a thread reading the requests of every one of them.
+ *
+ * @param argument A pointer to the Server structure.
+ *
+ * @return void* Never returns, the server runs until it is stopped.
+ */
+static void* accept_connections(void *argument) {
+    Server *server = argument;
+
+    while (1) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                /* Out of descriptors, the clients being served have to finish first */
+                printf("Error: Can not accept connection\n");
+                fflush(stdout);
+                struct timespec pause = {0, 100000000};
+                nanosleep(&pause, NULL);
+            }
+            continue;
+        }
+
+        ServeConnection *connection = malloc(sizeof(ServeConnection));
+        if (connection == NULL) {
+            close(fd);
+            continue;
+        }
+        connection->fd = fd;
+        connection->references = 1;
+        connection->server = server;
+        pthread_mutex_init(&connection->mutex, NULL);
+
+        pthread_mutex_lock(&server->mutex);
+        int refused = server->connection_count >= MAX_CONNECTIONS;
+        server->connection_count++;
+        pthread_mutex_unlock(&server->mutex);
+
+        /* Clients over the limit get one reply and are closed, without a thread of their own */
+        if (refused) {
+            printf("Error: Too many connections\n");
+            fflush(stdout);
+            uint64_t now_ns = read_clock(CLOCK_MONOTONIC);
+            ServeRequest request = {.connection = connection, .received_ns = now_ns};
+            send_reply(&request, ERR_SERVER_BUSY, now_ns, now_ns, 0);
+            release_connection(connection);
+            continue;
+        }
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, read_requests, connection) != 0) {
+            printf("Error: Can not create thread\n");
+            release_connection(connection);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Main loop of a worker of the server: runs requests as they come.
+ *
+ * @param index The index of the worker.
+ * @param context A pointer to the Server structure.
+ *
+ * This function does not return, the server runs until it is stopped.
+ *
+ * @note Like the workers of --batch, a worker keeps its pixel buffers and arena from one request to the next.
+ */
+static void serve_worker(int index, void *context) {
+    Server *server = context;
+    Png image = {0};
+    Arena arena = {0};
+    (void)index;
+
+    use_arena(&arena);
+    while (1) {
+        ServeRequest *request = take_request(server);
+
+        uint64_t start_ns = read_clock(CLOCK_MONOTONIC);
+        uint64_t start_cpu_ns = read_clock(CLOCK_THREAD_CPUTIME_ID);
+        int code = run_job(request->options, &image);
+        reset_arena(&arena);
+        uint64_t end_cpu_ns = read_clock(CLOCK_THREAD_CPUTIME_ID);
+        uint64_t end_ns = read_clock(CLOCK_MONOTONIC);
+
+        send_reply(request, code, start_ns, end_ns, end_cpu_ns - start_cpu_ns);
+        fflush(stdout);
+        release_connection(request->connection);
+        free_request(request);
+    }
+}
+
+/**
+ * @brief Removes the socket and ends the process when the server is stopped.
+ *
+ * @param signal_number The signal received.
+ *
+ * This function does not return.
+ */
+static void stop_server(int signal_number) {
+    (void)signal_number;
+    if (served_socket_path != NULL) {
+        unlink(served_socket_path);
+    }
+    _exit(0);
+}
+
+/**
+ * @brief Serves requests on a Unix socket until the process is stopped by SIGINT or SIGTERM.
+ *
+ * @param socket_path A string representing the file name/path of the socket, a socket already there is replaced.
+ *
+ * This function does not return.
+ *
+ * @note Every line a client sends is a request, a JSON object such as
+ *       {"id": 1, "input": "in.png", "output": "out.png", "args": ["--color_replace", "--old_color", "255.0.0", "--new_color", "0.0.255"]},
+ *       and every request gets one line of JSON back with its id, its status and its queue, wall and CPU time in seconds.
+ *       Requests run on the threads given by '--threads', each thread processes whole images, like the jobs of '--batch'.
+ *       Lines over MAX_REQUEST_LENGTH bytes, requests over MAX_QUEUED_REQUESTS waiting and clients over MAX_CONNECTIONS
+ *       get an error reply instead of being kept, so no client can take all the memory of the server.
+ */
+void run_server(char *socket_path) {
+    Server server = {0};
+    server.socket_path = socket_path;
+    pthread_mutex_init(&server.mutex, NULL);
+    pthread_cond_init(&server.request_ready, NULL);
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        printf("Error: Socket path %s is too long\n", socket_path);
+        exit(ERR_INSUFFICIENT_ARGUMENTS);
+    }
+    strcpy(address.sun_path, socket_path);
+
+    /* A socket left by a server that was killed is replaced, any other file is kept */
+    struct stat socket_stat;
+    if (lstat(socket_path, &socket_stat) == 0 && S_ISSOCK(socket_stat.st_mode)) {
+        unlink(socket_path);
+    }
+
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server.listen_fd < 0 || bind(server.listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(server.listen_fd, SOMAXCONN) != 0) {
+        printf("Error: Can not listen on socket %s\n", socket_path);
+        exit(ERR_FILE_WRITE_ERROR);
+    }
+
+    served_socket_path = socket_path;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_server;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, accept_connections, &server) != 0) {
+        printf("Error: Can not create thread\n");
+        stop_server(0);
+    }
+
+    printf("Serving on %s with %d workers\n", socket_path, get_thread_count());
+    fflush(stdout);
+
+    /* Workers take the whole pool, so the rows of each image are processed on its worker only */
+    run_parallel(get_thread_count(), serve_worker, &server);
+}
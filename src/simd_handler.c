@@ -0,0 +1,248 @@
+#include "structures.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
+
+/**
+ * @brief Replaces all pixels of the old color with the new color in a row, one pixel at a time.
+ * 
+ * @param row A pointer to the RGB pixel data of the row.
+ * @param width The number of pixels in the row.
+ * @param old_color The R, G and B bytes of the color to be replaced.
+ * @param new_color The R, G and B bytes of the color to replace with.
+ * 
+ * @return int The number of pixels replaced.
+ */
+int color_replace_scalar(png_bytep row, int width, const png_byte* old_color, const png_byte* new_color) {
+    int replaced = 0;
+    for (int x = 0; x < width; x++) {
+        png_bytep ptr = &(row[(size_t)x * 3]);
+        if (ptr[0] == old_color[0] && ptr[1] == old_color[1] && ptr[2] == old_color[2]) {
+            ptr[0] = new_color[0];
+            ptr[1] = new_color[1];
+            ptr[2] = new_color[2];
+            replaced++;
+        }
+    }
+    return replaced;
+}
+
+/**
+ * @brief Copies the pixels of a row that have no zero channel, one pixel at a time.
+ * 
+ * @param destination A pointer to the RGB pixel data the pixels are copied to.
+ * @param source A pointer to the RGB pixel data the pixels are copied from.
+ * @param width The number of pixels.
+ * 
+ * This function does not return a value.
+ */
+void masked_copy_scalar(png_bytep destination, png_const_bytep source, int width) {
+    for (int x = 0; x < width; x++) {
+        png_const_bytep from = &(source[(size_t)x * 3]);
+        if (from[0] != 0 && from[1] != 0 && from[2] != 0) {
+            png_bytep to = &(destination[(size_t)x * 3]);
+            to[0] = from[0];
+            to[1] = from[1];
+            to[2] = from[2];
+        }
+    }
+}
+
+#ifdef SIMD_X86
+
+/**
+ * @brief Fills 16 bytes with 5 repetitions of a RGB color, the last byte is left zero.
+ * 
+ * @param out The 16 bytes to be filled.
+ * @param color The R, G and B bytes of the color.
+ */
+static void fill_pattern(png_byte out[16], const png_byte* color) {
+    for (int i = 0; i < 15; i++) {
+        out[i] = color[i % 3];
+    }
+    out[15] = 0;
+}
+
+/*
+ * Both vector kernels look at 16 bytes as 5 whole pixels plus one spare byte.
+ * Bytes equal to the old color are found with one compare, then the byte shifts
+ * move the three results of every pixel onto its first byte, where they are
+ * combined, and spread the combined result back over the three bytes. The spare
+ * byte never matches, so it is written back unchanged.
+ */
+
+/**
+ * @brief Replaces all pixels of the old color with the new color in a row using SSE2, 5 pixels per step.
+ * 
+ * @param row A pointer to the RGB pixel data of the row.
+ * @param width The number of pixels in the row.
+ * @param old_color The R, G and B bytes of the color to be replaced.
+ * @param new_color The R, G and B bytes of the color to replace with.
+ * 
+ * @return int The number of pixels replaced.
+ */
+__attribute__((target("sse2")))
+static int color_replace_sse2(png_bytep row, int width, const png_byte* old_color, const png_byte* new_color) {
+    png_byte old_bytes[16], new_bytes[16];
+    fill_pattern(old_bytes, old_color);
+    fill_pattern(new_bytes, new_color);
+    const __m128i old_pattern = _mm_loadu_si128((const __m128i*)old_bytes);
+    const __m128i new_pattern = _mm_loadu_si128((const __m128i*)new_bytes);
+    const __m128i first_bytes = _mm_setr_epi8(-1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, 0);
+
+    size_t bytes = (size_t)width * 3;
+    size_t x = 0;
+    int replaced = 0;
+    for (; x + 16 <= bytes; x += 15) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(row + x));
+        __m128i equal = _mm_cmpeq_epi8(pixels, old_pattern);
+        /* Every pixel is matched when all its three bytes are */
+        __m128i match = _mm_and_si128(equal, _mm_and_si128(_mm_srli_si128(equal, 1), _mm_srli_si128(equal, 2)));
+        match = _mm_and_si128(match, first_bytes);
+        /* One bit per matched pixel, on its first byte */
+        int matched = _mm_movemask_epi8(match);
+        if (matched == 0) {
+            continue;
+        }
+        replaced += __builtin_popcount(matched);
+        match = _mm_or_si128(match, _mm_or_si128(_mm_slli_si128(match, 1), _mm_slli_si128(match, 2)));
+        pixels = _mm_or_si128(_mm_and_si128(match, new_pattern), _mm_andnot_si128(match, pixels));
+        _mm_storeu_si128((__m128i*)(row + x), pixels);
+    }
+
+    /* Remaining pixels */
+    return replaced + color_replace_scalar(row + x, (int)((bytes - x) / 3), old_color, new_color);
+}
+
+/**
+ * @brief Replaces all pixels of the old color with the new color in a row using AVX2, 10 pixels per step.
+ * 
+ * @param row A pointer to the RGB pixel data of the row.
+ * @param width The number of pixels in the row.
+ * @param old_color The R, G and B bytes of the color to be replaced.
+ * @param new_color The R, G and B bytes of the color to replace with.
+ * 
+ * @return int The number of pixels replaced.
+ * 
+ * @note The lower lane holds bytes [x, x + 16) and the upper lane bytes [x + 15, x + 31), so the per-lane
+ * byte shifts work on whole pixels in both lanes.
+ */
+__attribute__((target("avx2")))
+static int color_replace_avx2(png_bytep row, int width, const png_byte* old_color, const png_byte* new_color) {
+    png_byte old_bytes[16], new_bytes[16];
+    fill_pattern(old_bytes, old_color);
+    fill_pattern(new_bytes, new_color);
+    const __m256i old_pattern = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)old_bytes));
+    const __m256i new_pattern = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)new_bytes));
+    const __m256i first_bytes = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, 0));
+
+    size_t bytes = (size_t)width * 3;
+    size_t x = 0;
+    int replaced = 0;
+    for (; x + 31 <= bytes; x += 30) {
+        __m128i low = _mm_loadu_si128((const __m128i*)(row + x));
+        __m128i high = _mm_loadu_si128((const __m128i*)(row + x + 15));
+        __m256i pixels = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+        __m256i equal = _mm256_cmpeq_epi8(pixels, old_pattern);
+        /* Every pixel is matched when all its three bytes are */
+        __m256i match = _mm256_and_si256(equal, _mm256_and_si256(_mm256_srli_si256(equal, 1), _mm256_srli_si256(equal, 2)));
+        match = _mm256_and_si256(match, first_bytes);
+        /* One bit per matched pixel, on its first byte */
+        unsigned int matched = (unsigned int)_mm256_movemask_epi8(match);
+        if (matched == 0) {
+            continue;
+        }
+        replaced += __builtin_popcount(matched);
+        match = _mm256_or_si256(match, _mm256_or_si256(_mm256_slli_si256(match, 1), _mm256_slli_si256(match, 2)));
+        pixels = _mm256_blendv_epi8(pixels, new_pattern, match);
+        /* The lower lane goes first, its spare byte is the first byte of the upper lane */
+        _mm_storeu_si128((__m128i*)(row + x), _mm256_castsi256_si128(pixels));
+        _mm_storeu_si128((__m128i*)(row + x + 15), _mm256_extracti128_si256(pixels, 1));
+    }
+
+    /* Remaining pixels */
+    return replaced + color_replace_sse2(row + x, (int)((bytes - x) / 3), old_color, new_color);
+}
+
+/**
+ * @brief Copies the pixels of a row that have no zero channel using SSE2, 5 pixels per step.
+ * 
+ * @param destination A pointer to the RGB pixel data the pixels are copied to.
+ * @param source A pointer to the RGB pixel data the pixels are copied from.
+ * @param width The number of pixels.
+ * 
+ * This function does not return a value.
+ * 
+ * @note The rows may overlap if destination lies before source.
+ */
+__attribute__((target("sse2")))
+static void masked_copy_sse2(png_bytep destination, png_const_bytep source, int width) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i first_bytes = _mm_setr_epi8(-1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, 0);
+    const __m128i spare_byte = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, -1);
+
+    size_t bytes = (size_t)width * 3;
+    size_t x = 0;
+    for (; x + 16 <= bytes; x += 15) {
+        __m128i from = _mm_loadu_si128((const __m128i*)(source + x));
+        __m128i to = _mm_loadu_si128((const __m128i*)(destination + x));
+        __m128i zeros = _mm_cmpeq_epi8(from, zero);
+        /* A pixel is kept when any of its three bytes is zero */
+        __m128i keep = _mm_or_si128(zeros, _mm_or_si128(_mm_srli_si128(zeros, 1), _mm_srli_si128(zeros, 2)));
+        keep = _mm_and_si128(keep, first_bytes);
+        keep = _mm_or_si128(keep, _mm_or_si128(_mm_slli_si128(keep, 1), _mm_slli_si128(keep, 2)));
+        keep = _mm_or_si128(keep, spare_byte);
+        to = _mm_or_si128(_mm_and_si128(keep, to), _mm_andnot_si128(keep, from));
+        _mm_storeu_si128((__m128i*)(destination + x), to);
+    }
+
+    /* Remaining pixels */
+    masked_copy_scalar(destination + x, source + x, (int)((bytes - x) / 3));
+}
+
+#endif
+
+/**
+ * @brief Picks the fastest masked copy kernel for a pixel format supported by the processor.
+ * 
+ * @param format A pointer to the PixelFormat of the image.
+ * 
+ * @return MaskedCopyKernel The SSE2 kernel for 8-bit RGB when the processor supports it, the kernel of the format otherwise.
+ */
+MaskedCopyKernel select_masked_copy_kernel(const PixelFormat *format) {
+    if (format->color_type != PNG_COLOR_TYPE_RGB || format->bit_depth != 8) {
+        return format->masked_copy;
+    }
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        return masked_copy_sse2;
+    }
+#endif
+    return masked_copy_scalar;
+}
+
+/**
+ * @brief Picks the fastest color replacement kernel for a pixel format supported by the processor.
+ * 
+ * @param format A pointer to the PixelFormat of the image.
+ * 
+ * @return ColorReplaceKernel The AVX2 or SSE2 kernel for 8-bit RGB when the processor supports it, the kernel of the format otherwise.
+ */
+ColorReplaceKernel select_color_replace_kernel(const PixelFormat *format) {
+    if (format->color_type != PNG_COLOR_TYPE_RGB || format->bit_depth != 8) {
+        return format->color_replace;
+    }
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return color_replace_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return color_replace_sse2;
+    }
+#endif
+    return color_replace_scalar;
+}
@@ -0,0 +1,223 @@
+/* madvise is not part of POSIX, but it is the only way to hand pages of a file mapping back to the kernel. */
+#define _DEFAULT_SOURCE
+
+#include "errors.h"
+#include "structures.h"
+#include "error_handler.h"
+#include "profile_handler.h"
+
+/* Size in bytes the rows of one tile add up to. */
+#define TILE_BYTES (8 * 1024 * 1024)
+
+/* Largest pixel buffer kept in memory, 0 until it is set or computed from the size of the memory. */
+static size_t memory_limit = 0;
+
+/**
+ * @brief Sets the largest pixel buffer kept in memory, larger ones are backed by a scratch file.
+ *
+ * @param limit The size in bytes, 0 for half of the physical memory.
+ *
+ * This function does not return a value.
+ */
+void set_memory_limit(size_t limit) {
+    memory_limit = limit;
+}
+
+/**
+ * @brief Returns the largest pixel buffer kept in memory.
+ *
+ * @return size_t The size in bytes.
+ */
+static size_t get_memory_limit() {
+    if (memory_limit == 0) {
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long page_size = sysconf(_SC_PAGESIZE);
+        memory_limit = (pages > 0 && page_size > 0) ? (size_t)pages * page_size / 2 : SIZE_MAX;
+    }
+    return memory_limit;
+}
+
+/**
+ * @brief Maps an unnamed scratch file of the given size.
+ *
+ * @param size The size in bytes.
+ *
+ * @return png_bytep The mapping, MAP_FAILED if the file could not be created.
+ *
+ * @note The file is created in $TMPDIR, or /tmp if it is not set, and removed right away, so it disappears with the mapping.
+ */
+static png_bytep map_scratch_file(size_t size) {
+    const char *directory = getenv("TMPDIR");
+    if (directory == NULL || directory[0] == '\0') {
+        directory = "/tmp";
+    }
+    char *name = malloc(strlen(directory) + 32);
+    if (name == NULL) {
+        return MAP_FAILED;
+    }
+    sprintf(name, "%s/cw-pixels.XXXXXX", directory);
+
+    void *pixels = MAP_FAILED;
+    int fd = mkstemp(name);
+    if (fd >= 0) {
+        unlink(name);
+        if (ftruncate(fd, size) == 0) {
+            pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+    }
+    free(name);
+    return pixels;
+}
+
+/**
+ * @brief Allocates a PIXEL_ALIGNMENT-aligned pixel buffer, in memory or backed by a scratch file when it is over the memory limit.
+ *
+ * @param size The size in bytes.
+ * @param mapped A pointer where 1 is stored if the buffer is backed by a scratch file, 0 otherwise.
+ *
+ * @return png_bytep The buffer, to be freed with free_pixel_storage.
+ *
+ * @note Pages of a scratch file are written back to it instead of to swap, so images larger than the memory
+ *       only keep the tiles being worked on resident.
+ */
+png_bytep allocate_pixel_storage(size_t size, int *mapped) {
+    PROFILE_COUNT(allocations, 1);
+    if (size > get_memory_limit()) {
+        png_bytep pixels = map_scratch_file(size);
+        if (pixels == MAP_FAILED) {
+            printf("Error: Can not create scratch file for image pixels\n");
+            raise_error(ERR_MEMORY_ALLOCATION_FAILURE);
+        }
+        *mapped = 1;
+        return pixels;
+    }
+
+    void *pixels = NULL;
+    if (posix_memalign(&pixels, PIXEL_ALIGNMENT, size) != 0) {
+        printf("Error: Can not allocate memory for image pixels\n");
+        raise_error(ERR_MEMORY_ALLOCATION_FAILURE);
+    }
+    *mapped = 0;
+    return pixels;
+}
+
+/**
+ * @brief Frees a pixel buffer allocated with allocate_pixel_storage.
+ *
+ * @param pixels The buffer, may be NULL.
+ * @param size The size in bytes it was allocated with.
+ * @param mapped 1 if the buffer is backed by a scratch file, 0 otherwise.
+ *
+ * This function does not return a value.
+ */
+void free_pixel_storage(png_bytep pixels, size_t size, int mapped) {
+    if (mapped) {
+        munmap(pixels, size);
+    } else {
+        free(pixels);
+    }
+}
+
+/**
+ * @brief Returns the number of rows in one tile of an image.
+ *
+ * @param image A pointer to the Png structure representing the image.
+ *
+ * @return int The number of rows of about TILE_BYTES, at least 1.
+ */
+int get_tile_height(Png *image) {
+    size_t rows = image->stride ? TILE_BYTES / image->stride : 1;
+    return rows > 0 ? (rows < (size_t)image->height ? (int)rows : image->height) : 1;
+}
+
+/**
+ * @brief Finds the whole pages that hold the given rows.
+ *
+ * @param image A pointer to the Png structure representing the image.
+ * @param y_begin The first row.
+ * @param y_end The row after the last one.
+ * @param start A pointer where the first byte of the first page is stored.
+ * @param length A pointer where the size in bytes of the pages is stored.
+ *
+ * @return int 1 if the rows fill at least one page on their own, 0 otherwise.
+ *
+ * @note Only pages lying entirely inside the rows are included, so the rows around them are never affected.
+ */
+static int row_pages(Png *image, int y_begin, int y_end, png_bytep *start, size_t *length) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t begin = (size_t)(y_begin - image->rows_begin) * image->stride;
+    size_t end = (size_t)(y_end - image->rows_begin) * image->stride;
+    begin = (begin + page_size - 1) / page_size * page_size;
+    end = end / page_size * page_size;
+    if (begin >= end) {
+        return 0;
+    }
+    *start = image->pixels + begin;
+    *length = end - begin;
+    return 1;
+}
+
+/**
+ * @brief Tells the kernel that the given rows are about to be used, so a scratch file can read them ahead.
+ *
+ * @param image A pointer to the Png structure representing the image.
+ * @param y_begin The first row.
+ * @param y_end The row after the last one.
+ *
+ * This function does not return a value.
+ *
+ * @note Does nothing for images held in memory.
+ */
+void load_rows(Png *image, int y_begin, int y_end) {
+    png_bytep start;
+    size_t length;
+    if (image->pixels_mapped && row_pages(image, y_begin, y_end, &start, &length)) {
+        posix_madvise(start, length, POSIX_MADV_WILLNEED);
+    }
+}
+
+/**
+ * @brief Tells the kernel that the given rows are done with, so their pages can go back to the scratch file.
+ *
+ * @param image A pointer to the Png structure representing the image.
+ * @param y_begin The first row.
+ * @param y_end The row after the last one.
+ *
+ * This function does not return a value.
+ *
+ * @note Does nothing for images held in memory. The mapping is shared, so dropped pages keep their contents
+ *       and are read back from the file when they are used again.
+ */
+void release_rows(Png *image, int y_begin, int y_end) {
+    png_bytep start;
+    size_t length;
+    if (image->pixels_mapped && row_pages(image, y_begin, y_end, &start, &length)) {
+#ifdef MADV_PAGEOUT
+        madvise(start, length, MADV_PAGEOUT);
+#else
+        madvise(start, length, MADV_DONTNEED);
+#endif
+    }
+}
+
+/**
+ * @brief Calls a function for the given rows one tile at a time, loading every tile before and releasing it after.
+ *
+ * @param image A pointer to the Png structure representing the image.
+ * @param y_begin The first row.
+ * @param y_end The row after the last one.
+ * @param function The function called with the rows of every tile.
+ * @param context A pointer passed unchanged to every call of function.
+ *
+ * This function does not return a value.
+ */
+void for_each_tile(Png *image, int y_begin, int y_end, TileFunction function, void *context) {
+    int tile_height = get_tile_height(image);
+    for (int y = y_begin; y < y_end; y += tile_height) {
+        int tile_end = (y_end - y > tile_height) ? y + tile_height : y_end;
+        load_rows(image, y, tile_end);
+        function(image, y, tile_end, context);
+        release_rows(image, y, tile_end);
+    }
+}
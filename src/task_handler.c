@@ -1,7 +1,18 @@
 #include "errors.h"
 #include "structures.h"
+#include "error_handler.h"
 #include "drawing_handler.h"
+#include "file_handler.h"
 #include "preparation_handler.h"
+#include "simd_handler.h"
+#include "color_map_handler.h"
+#include "thread_handler.h"
+#include "rects_handler.h"
+#include "pipeline_handler.h"
+#include "pixel_handler.h"
+#include "palette_handler.h"
+#include "storage_handler.h"
+#include "profile_handler.h"
 
 /**
  * @brief Prints the help message explaining the usage of the program and its options.
@@ -15,19 +26,38 @@
  */
 void print_help() {
     printf("Course work for option 5.16, created by Matvei Kolesnichenko.\n");
-    printf("Usage: ./program [OPTIONS] [input_file]\n\n");
+    printf("Usage: ./program [OPTIONS] [input_file]\n");
+    printf("Functions can be chained, they run in the given order and each one takes the options that follow it.\n\n");
     printf("Options:\n");
     printf("  -h, --help                Display this help message\n");
     printf("  --info                    Print detailed information about the input PNG file\n");
-    printf("  -i, --input <filename>    Specify the input PNG file\n");
-    printf("  -o, --output <filename>   Specify the output PNG file (default: out.png)\n\n");
+    printf("  -i, --input <filename>    Specify the input PNG file, - for standard input\n");
+    printf("  -o, --output <filename>   Specify the output PNG file, - for standard output (default: out.png)\n");
+    printf("  --threads <value>         Specify the number of threads to process the image with (default: 1)\n");
+    printf("  --memory_limit <value>    Specify the largest image in MiB kept in memory, larger ones are paged through a scratch file\n");
+    printf("                            (default: half of the physical memory)\n");
+    printf("  --profile                 Print the time of every stage and counters of the run as one line of JSON\n");
+    printf("  --batch <filename>        Process every line of a manifest, each holding the options of one run\n");
+    printf("  --serve <socket>          Answer requests on a Unix socket, each a line of JSON holding the options of one run\n\n");
+    printf("  --encode <fast|balanced|small>\n");
+    printf("                            Specify a preset of the encoder settings below\n");
+    printf("  --compression_level <value>\n");
+    printf("                            Specify the zlib compression level from 0 to 9\n");
+    printf("  --strategy <default|filtered|huffman|rle|fixed>\n");
+    printf("                            Specify the zlib strategy\n");
+    printf("  --filters <none,sub,up,avg,paeth|all>\n");
+    printf("                            Specify the row filters the encoder may choose from\n");
+    printf("  --buffer_size <value>     Specify the size of the compression buffer in bytes\n");
+    printf("  --output_buffer_size <value>\n");
+    printf("                            Specify the size of the buffer the output file is written through in bytes\n\n");
     printf("  --copy                    Copy a specified region of the image\n");
     printf("  --left_up <x.y>           Specify the coordinates of the top left corner of the source area\n");
     printf("  --right_down <x.y>        Specify the coordinates of the bottom right corner of the source area\n");
     printf("  --dest_left_up <x.y>      Specify the coordinates of the top left corner of the destination area\n\n");
     printf("  --color_replace           Replace all pixels of a specified color with another color\n");
     printf("  --old_color <r.g.b>       Specify the color to be replaced\n");
-    printf("  --new_color <r.g.b>       Specify the color to replace with\n\n");
+    printf("  --new_color <r.g.b>       Specify the color to replace with\n");
+    printf("  --color_map <filename>    Specify a file of \"r.g.b r.g.b\" lines to replace many colors in one pass\n\n");
     printf("  --ornament                Create a patterned frame\n");
     printf("  --pattern <rectangle|circle|semicircles>\n");
     printf("                            Specify the pattern of the frame\n");
@@ -83,17 +113,16 @@ void print_png_info(Png *image) {
 }
 
 /**
- * @brief Replaces all pixels of the specified old color with the new color.
+ * @brief Parses the colors of the 'color_replace' function into a context for color_replace_row.
  * 
- * @param image A pointer to the Png structure representing the image.
+ * @param context A pointer to the ColorReplaceContext structure to be filled.
+ * @param image A pointer to the Png structure representing the image, only its header is used.
  * @param old_color A string representing the old color in the format "R,G,B".
  * @param new_color A string representing the new color in the format "R,G,B".
  * 
  * This function does not return a value.
  */
-void color_replace(Png *image, char* old_color, char* new_color) {
-    int x, y;
-
+void prepare_color_replace(ColorReplaceContext *context, Png *image, char* old_color, char* new_color) {
     /* Getting colors as arrays */
     int* old_color_values = process_color(old_color);
     int* new_color_values = process_color(new_color);
@@ -101,36 +130,92 @@ void color_replace(Png *image, char* old_color, char* new_color) {
     /* Error handling */
     if (!old_color_values || !new_color_values) {
         printf("Error: Can not process color\n");
-        exit(ERR_INSUFFICIENT_ARGUMENTS);
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
     }
 
-    /* Nested loop to iterate through each pixel of the image */
-    for (y = 0; y < image->height; y++) {
-        png_bytep row = image->row_pointers[y];
-        for (x = 0; x < image->width; x++) {
-            png_bytep ptr = &(row[x * 3]); // Getting pixel
-            /* Changing by colors */
-            if ((ptr[0] == old_color_values[0]) && (ptr[1] == old_color_values[1]) && (ptr[2] == old_color_values[2])) {
-                draw_pixel(ptr, new_color_values);
-            }
-        }
-    }
+    encode_color(image->format, old_color_values, context->old_color);
+    encode_color(image->format, new_color_values, context->new_color);
+    context->kernel = select_color_replace_kernel(image->format);
 }
 
 /**
- * @brief Copies the specified area from the original image to a new structure, then copies it back to the original image at a different location.
+ * @brief Replaces all pixels of the old color with the new color in a single row.
  * 
- * @param image A pointer to the Png structure representing the original image.
+ * @param image A pointer to the Png structure the row belongs to.
+ * @param row A pointer to the pixel data of the row.
+ * @param y The index of the row in the image.
+ * @param context A pointer to the ColorReplaceContext prepared by prepare_color_replace.
+ * 
+ * This function does not return a value.
+ */
+void color_replace_row(Png *image, png_bytep row, int y, void *context) {
+    ColorReplaceContext *colors = context;
+    (void)y;
+
+    int replaced = colors->kernel(row, image->width, colors->old_color, colors->new_color);
+    PROFILE_COUNT(pixels_modified, replaced);
+}
+
+/**
+ * @brief Replaces all pixels of the specified old color with the new color.
+ * 
+ * @param image A pointer to the Png structure representing the image.
+ * @param old_color A string representing the old color in the format "R,G,B".
+ * @param new_color A string representing the new color in the format "R,G,B".
+ * 
+ * This function does not return a value.
+ */
+void color_replace(Png *image, char* old_color, char* new_color) {
+    ColorReplaceContext context;
+    prepare_color_replace(&context, image, old_color, new_color);
+    parallel_rows(image, color_replace_row, &context);
+}
+
+/**
+ * @brief Replaces all pixels of every old color listed in a color map file with its new color in one pass.
+ * 
+ * @param image A pointer to the Png structure representing the image.
+ * @param file_name A string representing the file name/path of the color map.
+ * 
+ * This function does not return a value.
+ */
+void color_map_replace(Png *image, char* file_name) {
+    ColorMap *map = process_color_map(file_name, image->format);
+    parallel_rows(image, color_map_row, map);
+}
+
+/**
+ * @brief Clips one axis of the copied area against the image, so every source and destination position left is inside it.
+ * 
+ * @param begin A pointer to the first source position, moved forward if needed.
+ * @param end A pointer to the last source position, moved backward if needed.
+ * @param offset The distance from a source position to its destination position.
+ * @param size The size of the image along the axis.
+ * 
+ * This function does not return a value.
+ */
+static void clip_copy_axis(int *begin, int *end, int offset, int size) {
+    /* Source pixels outside the image are black, so they are never pasted */
+    if (*begin < 0) *begin = 0;
+    if (*end > size - 1) *end = size - 1;
+
+    /* Destination pixels have to be inside the image too */
+    if (*begin < -offset) *begin = -offset;
+    if (*end > size - 1 - offset) *end = size - 1 - offset;
+}
+
+/**
+ * @brief Parses the corners of the 'copy' function and clips the copied area against the image.
+ * 
+ * @param image A pointer to the Png structure representing the image, only its header is used.
  * @param left_up A string containing the coordinates of the top-left corner of the area to be copied in the format "x,y".
  * @param right_down A string containing the coordinates of the bottom-right corner of the area to be copied in the format "x,y".
  * @param dest_left_up A string containing the coordinates of the top-left corner of the destination location in the original image for the copied area.
+ * @param area A pointer to the CopyArea structure to be filled.
  * 
  * This function does not return a value.
  */
-void copy_area(Png *image, char* left_up, char* right_down, char* dest_left_up) {
-    int x, y;
-    int area_x = 0, area_y = 0;
-
+static void clip_copy_area(Png *image, char* left_up, char* right_down, char* dest_left_up, CopyArea *area) {
     /* Getting coordinates as arrays */
     int* left_up_coordinates = process_coordinates(left_up);
     int* right_down_coordinates = process_coordinates(right_down);
@@ -139,83 +224,85 @@ void copy_area(Png *image, char* left_up, char* right_down, char* dest_left_up)
     /* Error handling */
     if (!left_up_coordinates || !right_down_coordinates || !dest_left_up_coordinates){
         printf("Error: Can not process coordinates\n");
-        exit(ERR_INSUFFICIENT_ARGUMENTS);
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
     }
 
-    /* Making structure and its information */
-    Area* copied_area = malloc(sizeof(Area));
-    if (copied_area == NULL) {
-        printf("Error: Can not allocate memory for copied area\n");
-        exit(ERR_MEMORY_ALLOCATION_FAILURE);
-    }
-    copied_area->height = abs(right_down_coordinates[1] - left_up_coordinates[1] + 1);
-    copied_area->width = abs(right_down_coordinates[0] - left_up_coordinates[0] + 1);
-    copied_area->row_pointers = malloc(sizeof(png_bytep) * copied_area->height);
-    if (copied_area->row_pointers == NULL) {
-        printf("Error: Can not allocate memory for copied area row_pointers\n");
-        exit(ERR_MEMORY_ALLOCATION_FAILURE);
-    }
+    /* Ordering corners of the copied area */
+    Rect source;
+    source.x1 = left_up_coordinates[0] < right_down_coordinates[0] ? left_up_coordinates[0] : right_down_coordinates[0];
+    source.x2 = left_up_coordinates[0] < right_down_coordinates[0] ? right_down_coordinates[0] : left_up_coordinates[0];
+    source.y1 = left_up_coordinates[1] < right_down_coordinates[1] ? left_up_coordinates[1] : right_down_coordinates[1];
+    source.y2 = left_up_coordinates[1] < right_down_coordinates[1] ? right_down_coordinates[1] : left_up_coordinates[1];
+    area->offset_x = dest_left_up_coordinates[0] - source.x1;
+    area->offset_y = dest_left_up_coordinates[1] - source.y1;
+
+    clip_copy_axis(&source.x1, &source.x2, area->offset_x, image->width);
+    clip_copy_axis(&source.y1, &source.y2, area->offset_y, image->height);
+    area->source = source;
+}
 
-    /* Allocating memory for each pixel */
-    for (y = 0; y < copied_area->height; y++) {
-        copied_area->row_pointers[y] = malloc(sizeof(png_byte) * copied_area->width * 3);
-        if (copied_area->row_pointers[y] == NULL) {
-            printf("Error: Can not allocate memory for copied area pixel\n");
-            exit(ERR_MEMORY_ALLOCATION_FAILURE);
-        }
+/**
+ * @brief Copies the specified area of the image to a different location, skipping pixels with a zero channel.
+ * 
+ * @param image A pointer to the Png structure representing the original image.
+ * @param left_up A string containing the coordinates of the top-left corner of the area to be copied in the format "x,y".
+ * @param right_down A string containing the coordinates of the bottom-right corner of the area to be copied in the format "x,y".
+ * @param dest_left_up A string containing the coordinates of the top-left corner of the destination location in the original image for the copied area.
+ * 
+ * This function does not return a value.
+ * 
+ * @note The area is clipped once and copied row by row in place, in the order that reads every source pixel before it can be overwritten.
+ *       Rows are copied a tile at a time, so only the tiles being copied of an image over the memory limit stay in memory.
+ */
+void copy_area(Png *image, char* left_up, char* right_down, char* dest_left_up) {
+    CopyArea area;
+    clip_copy_area(image, left_up, right_down, dest_left_up, &area);
+    int x_begin = area.source.x1;
+    int x_end = area.source.x2;
+    int y_begin = area.source.y1;
+    int y_end = area.source.y2;
+    int offset_x = area.offset_x;
+    int offset_y = area.offset_y;
+    if (x_begin > x_end || y_begin > y_end) {
+        return;
     }
 
-    /* Switching left and right if needed */
-    if (left_up_coordinates[0] > right_down_coordinates[0]){
-        int tmp[2];
-        tmp[0] = right_down_coordinates[0];
-        tmp[1] = right_down_coordinates[1];
-        right_down_coordinates[0] = left_up_coordinates[0];
-        right_down_coordinates[1] = left_up_coordinates[1];
-        left_up_coordinates[0] = tmp[0];
-        left_up_coordinates[1] = tmp[1];
-    }
-    
-    /* Copying area from original image to structure */
-    for (y = left_up_coordinates[1]; y <= right_down_coordinates[1]; y++) {
-        for (x = left_up_coordinates[0]; x <= right_down_coordinates[0]; x++) {
-            /* Handling inappropriate coordinate */
-            if (x < 0 || x >= image->width || y < 0 || y >= image->height) {
-                copied_area->row_pointers[area_y][area_x*3] = 0;
-                copied_area->row_pointers[area_y][area_x*3 + 1] = 0;
-                copied_area->row_pointers[area_y][area_x*3 + 2] = 0;
+    MaskedCopyKernel kernel = select_masked_copy_kernel(image->format);
+    size_t bytes = (size_t)(x_end - x_begin + 1) * image->pixel_bytes;
+    int width = x_end - x_begin + 1;
+    int height = y_end - y_begin + 1;
+    PROFILE_COUNT(pixels_visited, (uint64_t)width * height);
+    PROFILE_COUNT(pixels_modified, (uint64_t)width * height);
+
+    /* Moving down means the lowest rows have to be copied first */
+    int step = offset_y > 0 ? -1 : 1;
+    int y = offset_y > 0 ? y_end : y_begin;
+    int tile_height = get_tile_height(image);
+
+    for (int i = 0; i < height; i += tile_height) {
+        /* Source and destination rows of the tile are loaded together and released once it is copied */
+        int count = (height - i > tile_height) ? tile_height : height - i;
+        int tile_begin = step > 0 ? y : y - count + 1;
+        load_rows(image, tile_begin, tile_begin + count);
+        load_rows(image, tile_begin + offset_y, tile_begin + offset_y + count);
+
+        for (int j = 0; j < count; j++, y += step) {
+            png_bytep source = image->row_pointers[y] + (size_t)x_begin * image->pixel_bytes;
+            png_bytep destination = image->row_pointers[y + offset_y] + (size_t)(x_begin + offset_x) * image->pixel_bytes;
+
+            if (memchr(source, 0, bytes) == NULL) {
+                /* No pixel is skipped, so the row is copied as a whole */
+                memmove(destination, source, bytes);
+            } else if (offset_y == 0 && offset_x > 0) {
+                /* Moving right within the same row has to start from the last pixel */
+                image->format->masked_copy_backward(destination, source, width);
             } else {
-                /* Copying every pixel by R, G, B */
-                copied_area->row_pointers[area_y][area_x * 3] = image->row_pointers[y][x * 3];
-                copied_area->row_pointers[area_y][area_x * 3 + 1] = image->row_pointers[y][x * 3 + 1];
-                copied_area->row_pointers[area_y][area_x * 3 + 2] = image->row_pointers[y][x * 3 + 2];
+                kernel(destination, source, width);
             }
-            area_x++;
         }
-        area_x = 0;
-        area_y++;
-    }
-
-    area_x = 0;
-    area_y = 0;
 
-    /* Copying area from structure back to original image */
-    for (y = dest_left_up_coordinates[1]; y < dest_left_up_coordinates[1] + copied_area->height; y++) {
-        for (x = dest_left_up_coordinates[0]; x < dest_left_up_coordinates[0] + copied_area->width; x++) {
-            /* Handling inappropriate coordinate */
-            if (x < 0 || x >= image->width || y < 0 || y >= image->height) {
-                continue;
-            }
-            if (copied_area->row_pointers[area_y][area_x * 3] != 0 && copied_area->row_pointers[area_y][area_x * 3 + 1] != 0 && copied_area->row_pointers[area_y][area_x * 3 + 2] != 0) {
-                /* Copying every pixel by R, G, B */
-                image->row_pointers[y][x * 3] = copied_area->row_pointers[area_y][area_x * 3];
-                image->row_pointers[y][x * 3 + 1] = copied_area->row_pointers[area_y][area_x * 3 + 1];
-                image->row_pointers[y][x * 3 + 2] = copied_area->row_pointers[area_y][area_x * 3 + 2];
-            }
-            area_x++;
-        }
-        area_x = 0;
-        area_y++;
+        release_rows(image, tile_begin, tile_begin + count);
+        release_rows(image, tile_begin + offset_y, tile_begin + offset_y + count);
     }
 }
 
@@ -230,30 +317,13 @@ void copy_area(Png *image, char* left_up, char* right_down, char* dest_left_up)
  * This function does not return a value.
  */
 void filled_rects(Png *image, char* string_color, char* string_border_color, char* thickness) {
-    /* Allocate memory for tracking visited pixels */
-    int** visited = malloc(sizeof(int*) * image->height);
-    if (visited == NULL) {
-        printf("Error: Can not allocate memory for rectangles visited pixels\n");
-        exit(ERR_MEMORY_ALLOCATION_FAILURE);
-    }
-    for (int i = 0; i < image->height; i++) {
-        visited[i] = malloc(sizeof(int) * image->width);
-        if (visited[i] == NULL) {
-            printf("Error: Can not allocate memory for rectangles visited pixels\n");
-            exit(ERR_MEMORY_ALLOCATION_FAILURE);
-        }
-        for (int j = 0; j < image->width; j++) {
-            visited[i][j] = 0;
-        }
-    }
-
     /* Getting color as array */
     int* color_values = process_color(string_color);
 
     /* Error handling: Cannot process rectangle color */
     if (!color_values) {
         printf("Error: Can not process rectangle color\n");
-        exit(ERR_INSUFFICIENT_ARGUMENTS);
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
     }
 
     /* Processing border color */
@@ -262,74 +332,55 @@ void filled_rects(Png *image, char* string_color, char* string_border_color, cha
     /* Error handling: Cannot process border color */
     if (!border_color) {
         printf("Error: Can not process border color\n");
-        exit(ERR_INSUFFICIENT_ARGUMENTS);
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
     }
 
-    /* Nested loop to iterate through all pixels */
-    for (int y = 0; y < image->height; y++) {
-        png_bytep row = image->row_pointers[y];
-        for (int x = 0; x < image->width; x++) {
-            /* Skip visited or other color pixels */
-            if (visited[y][x] || !(row[x * 3] == color_values[0] && row[x * 3 + 1] == color_values[1] && row[x * 3 + 2] == color_values[2])) {
-                continue;
-            }
-            int start_x = x;
-            int start_y = y;
-            int end_x = start_x;
-            int end_y = start_y;
-
-            /* Finding end horizontally */
-            while (end_x < image->width && visited[end_y][end_x] == 0 && row[end_x * 3] == color_values[0] && row[end_x * 3 + 1] == color_values[1] && row[end_x * 3 + 2] == color_values[2]) {
-                end_x++;
-            }
+    /* Converting both colors to pixels of the image */
+    png_byte color[MAX_PIXEL_BYTES];
+    png_byte border_pixel[MAX_PIXEL_BYTES];
+    encode_color(image->format, color_values, color);
+    encode_color(image->format, border_color, border_pixel);
 
-            /* Finding end vertically */
-            while (end_y < image->height) {
-                int found_different_color = 0;
-                for (int i = start_x; i < end_x; i++) {
-                    if (visited[end_y][i] || !(image->row_pointers[end_y][i * 3] == color_values[0] && image->row_pointers[end_y][i * 3 + 1] == color_values[1] && image->row_pointers[end_y][i * 3 + 2] == color_values[2])) {
-                        found_different_color = 1;
-                        break;
-                    }
-                }
-                if (found_different_color) {
-                    break;
-                }
-                end_y++;
-            }
+    int border_thickness = atoi(thickness);
+    if (border_thickness <= 0) {
+        printf("Error: Border thickness is not a positive integer\n");
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+    }
 
-            draw_border(image, start_x, start_y, end_x - 1, end_y - 1, border_color, thickness);
+    /* Finding all rectangles, each one seeing the borders of those found before it */
+    RectList list = {NULL, 0, 0};
+    find_filled_rects(image, color, border_pixel, border_thickness, &list);
+    PROFILE_COUNT(rects_found, list.count);
 
-            /* Marking visited pixels */
-            for (int i = start_y; i < end_y; i++) {
-                for (int j = start_x; j < end_x; j++) {
-                    visited[i][j] = 1;
-                }
-            }
-        }
-    }
+    /* Drawing all borders in one pass over the rows, they have one color so the order does not matter */
+    draw_borders(image, &list, border_pixel, border_thickness);
+
+    free(list.rects);
 }
 
 /**
- * @brief Draws an ornament pattern on the given image.
+ * @brief Parses the options of the 'ornament' function into a context for the row function of its pattern.
  * 
- * @param image A pointer to the Png structure representing the image.
+ * @param image A pointer to the Png structure representing the image, only its header is used.
  * @param pattern A string specifying the type of ornament pattern ("rectangle", "circle", "semicircles").
  * @param string_color A string representing the color of the ornament in the format "rrr.ggg.bbb".
  * @param thickness A string representing the thickness of the ornament.
  * @param count A string representing the number of ornaments to be drawn.
+ * @param context A pointer to the OrnamentContext to be filled, its rects are taken from the arena of the job.
  * 
- * This function does not return a value.
+ * @return RowFunction The function drawing the part of the pattern that lies in a row.
  */
-void ornament(Png *image, char* pattern, char* string_color, char* thickness, char* count) {
+RowFunction prepare_ornament(Png *image, char* pattern, char* string_color, char* thickness, char* count, OrnamentContext *context) {
     /* Getting color as array */
     int* color_values = process_color(string_color);
 
     /* Error handling: Cannot process ornament color */
     if (!color_values) {
         printf("Error: Can not process ornament color\n");
-        exit(ERR_INSUFFICIENT_ARGUMENTS);
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
     }
+    png_byte color[MAX_PIXEL_BYTES];
+    encode_color(image->format, color_values, color);
 
     /* Getting thickness as integer */
     int ornament_thickness = atoi(thickness);
@@ -337,7 +388,7 @@ void ornament(Png *image, char* pattern, char* string_color, char* thickness, ch
     /* Error handling: Ornament thickness is not a positive integer */
     if (ornament_thickness <= 0) {
         printf("Error: Ornament thickness is not a positive integer\n");
-        exit(ERR_INSUFFICIENT_ARGUMENTS);
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
     }
 
     /* Getting count as integer */
@@ -346,28 +397,236 @@ void ornament(Png *image, char* pattern, char* string_color, char* thickness, ch
     /* Error handling: Ornament count is not a positive integer */
     if (ornament_count <= 0) {
         printf("Error: Ornament count is not a positive integer\n");
-        exit(ERR_INSUFFICIENT_ARGUMENTS);
+        raise_error(ERR_INSUFFICIENT_ARGUMENTS);
     }
 
     /* Rectangle pattern */
     if (strcmp(pattern, "rectangle") == 0){
-        rectangle_ornament(image, ornament_thickness, ornament_count, color_values, thickness);
+        prepare_rectangle_ornament(image, ornament_thickness, ornament_count, color, thickness, context);
+        return rectangle_ornament_row;
 
     /* Circle pattern */
     } else if (strcmp(pattern, "circle") == 0) {
-        circle_ornament(image, color_values);
+        *context = (OrnamentContext){{0}, 0, 0, NULL, 0, 0, 0};
+        memcpy(context->color, color, image->pixel_bytes);
+        return circle_ornament_row;
 
     /* Semicircles pattern */
     } else if (strcmp(pattern, "semicircles") == 0){
-        semicircles_ornament(image, ornament_thickness, ornament_count, color_values);
+        prepare_semicircles_ornament(image, ornament_thickness, ornament_count, color, context);
+        return semicircles_ornament_row;
     }
+
     /* Unknown pattern */
-    else {
-        printf("Error: Unknown pattern\n");
-        exit(ERR_INSUFFICIENT_ARGUMENTS);
+    printf("Error: Unknown pattern\n");
+    raise_error(ERR_INSUFFICIENT_ARGUMENTS);
+}
+
+/**
+ * @brief Draws an ornament pattern on the given image.
+ * 
+ * @param image A pointer to the Png structure representing the image.
+ * @param pattern A string specifying the type of ornament pattern ("rectangle", "circle", "semicircles").
+ * @param string_color A string representing the color of the ornament in the format "rrr.ggg.bbb".
+ * @param thickness A string representing the thickness of the ornament.
+ * @param count A string representing the number of ornaments to be drawn.
+ * 
+ * This function does not return a value.
+ */
+void ornament(Png *image, char* pattern, char* string_color, char* thickness, char* count) {
+    OrnamentContext context;
+    RowFunction function = prepare_ornament(image, pattern, string_color, thickness, count, &context);
+    parallel_rows(image, function, &context);
+}
+
+/**
+ * @brief Runs the task by rewriting the palette of the input file, if the task and the input allow it.
+ * 
+ * @param options Options structure containing flags and values for various tasks.
+ * 
+ * @return int 1 if the task was completed, 0 if the pixels have to be processed.
+ * 
+ * @note Only pipelines of 'color_replace' functions without color maps are done this way, and only for indexed-color inputs
+ *       whose palette does not already hold a new color.
+ */
+int palette_task_switcher(Options options) {
+    if (options.flag_info || options.operation_count == 0) {
+        return 0;
+    }
+    /* Standard input can be read only once, so the pixels could not be processed after it */
+    if (strcmp(options.input_file, "-") == 0) {
+        return 0;
+    }
+    for (int i = 0; i < options.operation_count; i++) {
+        if (options.operations[i].type != OPERATION_COLOR_REPLACE || options.operations[i].flag_color_map) {
+            return 0;
+        }
+    }
+
+    return rewrite_palette(options.input_file, options.output_file, options.operations, options.operation_count, &options.encoder);
+}
+
+/**
+ * @brief Applies one function of the pipeline to the image.
+ * 
+ * @param operation A pointer to the Operation structure holding the function and its options.
+ * @param image Pointer to the Png structure representing the image.
+ * 
+ * This function does not return a value.
+ */
+void run_operation(Operation *operation, Png *image) {
+    switch (operation->type) {
+        case OPERATION_COPY:
+            copy_area(image, operation->left_up_value, operation->right_down_value, operation->dest_left_up_value);
+            break;
+        case OPERATION_COLOR_REPLACE:
+            if (operation->flag_color_map) {
+                color_map_replace(image, operation->color_map_value);
+            } else {
+                color_replace(image, operation->old_color_value, operation->new_color_value);
+            }
+            break;
+        case OPERATION_ORNAMENT:
+            ornament(image, operation->pattern_value, operation->color_value, operation->thickness_value, operation->count_value);
+            break;
+        case OPERATION_FILLED_RECTS:
+            filled_rects(image, operation->color_value, operation->border_color_value, operation->thickness_value);
+            break;
+    }
+}
+
+/**
+ * @brief Applies functions to an image, in the order they were given, each one to the result of the previous one.
+ * 
+ * @param operations The functions.
+ * @param operation_count The number of functions in operations.
+ * @param image Pointer to the Png structure representing the image.
+ * 
+ * This function does not return a value.
+ * 
+ * @note Consecutive row-local functions are fused, so every row goes through all of them while it is in cache.
+ */
+void run_operations(Operation *operations, int operation_count, Png *image) {
+    int i = 0;
+    while (i < operation_count) {
+        Pipeline pipeline;
+        int fused = fuse_operations(&operations[i], operation_count - i, image, &pipeline);
+
+        /* Functions reading other rows are barriers run on their own */
+        if (fused == 0) {
+            run_operation(&operations[i], image);
+            i++;
+            continue;
+        }
+
+        /* Row-local functions in a row are applied in one pass over the rows */
+        parallel_rows(image, pipeline_row, &pipeline);
+        i += fused;
     }
 }
 
+/**
+ * @brief Finds the rows the functions that are not row-local read or write, once the header of a streamed image is read.
+ * 
+ * @param image A pointer to the Png structure of the image, rows_begin and rows_end are set to the rows found.
+ * @param context A pointer to the StreamTask structure, whose pipeline is prepared too.
+ * 
+ * This function does not return a value.
+ * 
+ * @note Only 'copy' is expected besides the row-local functions, its rows are the source and destination rows of the clipped area.
+ */
+static void prepare_stream(Png *image, void *context) {
+    StreamTask *task = context;
+    prepare_pipeline(image, &task->pipeline);
+
+    image->rows_begin = image->height;
+    image->rows_end = 0;
+    for (int i = 0; i < task->operation_count; i++) {
+        Operation *operation = &task->operations[i];
+        if (operation->type != OPERATION_COPY) {
+            continue;
+        }
+        CopyArea area;
+        clip_copy_area(image, operation->left_up_value, operation->right_down_value, operation->dest_left_up_value, &area);
+        if (area.source.x1 > area.source.x2 || area.source.y1 > area.source.y2) {
+            continue;
+        }
+        int y_begin = area.offset_y < 0 ? area.source.y1 + area.offset_y : area.source.y1;
+        int y_end = (area.offset_y > 0 ? area.source.y2 + area.offset_y : area.source.y2) + 1;
+        if (y_begin < image->rows_begin) image->rows_begin = y_begin;
+        if (y_end > image->rows_end) image->rows_end = y_end;
+    }
+    if (image->rows_begin >= image->rows_end) {
+        image->rows_begin = 0;
+        image->rows_end = 0;
+    }
+}
+
+/**
+ * @brief Applies the row-local functions of a streamed image to a row no other function reads or writes.
+ * 
+ * @param image A pointer to the Png structure of the image.
+ * @param row A pointer to the pixel data of the row.
+ * @param y The index of the row in the image.
+ * @param context A pointer to the StreamTask structure.
+ * 
+ * This function does not return a value.
+ */
+static void stream_row(Png *image, png_bytep row, int y, void *context) {
+    StreamTask *task = context;
+    pipeline_row(image, row, y, &task->pipeline);
+}
+
+/**
+ * @brief Applies all functions of a streamed image to the rows held in memory.
+ * 
+ * @param image A pointer to the Png structure of the image, its rows from rows_begin to rows_end are read.
+ * @param context A pointer to the StreamTask structure.
+ * 
+ * This function does not return a value.
+ */
+static void process_stream_window(Png *image, void *context) {
+    StreamTask *task = context;
+    run_operations(task->operations, task->operation_count, image);
+}
+
+/**
+ * @brief Runs the task while streaming the image from the input file to the output file, if the task allows it.
+ * 
+ * @param options Options structure containing flags and values for various tasks.
+ * 
+ * @return int 1 if the task was completed by streaming, 0 if the image has to be read as a whole and passed to task_switcher.
+ * 
+ * @note Row-local functions are applied to every row on the way. Only the rows 'copy' reads or writes are decoded into memory,
+ *       all of the functions are applied to them there, and every other row is streamed straight through.
+ *       'filled_rects' searches the whole image, so it is never streamed, and neither are interlaced inputs.
+ *       Rows are encoded one at a time while streaming, so when threads are free the image is read as a whole instead and
+ *       encoded in parallel strips, which takes the memory of the whole image.
+ */
+int stream_task_switcher(Options options) {
+    if (options.flag_info || options.operation_count == 0) {
+        return 0;
+    }
+    /* Standard input can be read only once, so it can not be read again if it turns out to be interlaced */
+    if (strcmp(options.input_file, "-") == 0) {
+        return 0;
+    }
+    for (int i = 0; i < options.operation_count; i++) {
+        if (options.operations[i].type == OPERATION_FILLED_RECTS) {
+            return 0;
+        }
+    }
+    /* Free threads would be left idle by the row by row encoder */
+    if (get_free_thread_count() > 1) {
+        return 0;
+    }
+
+    /* The functions are prepared once the header is read, as they depend on the size of the image */
+    StreamTask task = {options.operations, options.operation_count, {NULL, 0}};
+    fuse_row_local_operations(options.operations, options.operation_count, &task.pipeline);
+    return stream_png_file(options.input_file, options.output_file, prepare_stream, stream_row, process_stream_window, &task, &options.encoder);
+}
+
 /**
  * @brief Handles task switching based on provided options.
  * 
@@ -379,22 +638,58 @@ void ornament(Png *image, char* pattern, char* string_color, char* thickness, ch
 void task_switcher(Options options, Png *image) {
     if (options.flag_info) {
         print_png_info(image);
-        exit(EXIT_SUCCESS);
+        return;
     }
 
-    if (options.flag_copy) {
-        copy_area(image, options.left_up_value, options.right_down_value, options.dest_left_up_value);
-    }
+    run_operations(options.operations, options.operation_count, image);
+}
 
-    if (options.flag_color_replace) {
-        color_replace(image, options.old_color_value, options.new_color_value);
-    }
+/**
+ * @brief Runs the task given by the options on one image, from reading the input file to writing the output file.
+ * 
+ * @param options Options structure containing flags and values for various tasks.
+ * @param image Pointer to the Png structure the image is read into.
+ * 
+ * This function does not return a value.
+ * 
+ * @note Pixel buffers left in image by a previous call are reused, the libpng structures are destroyed before returning.
+ */
+void run_task(Options options, Png *image) {
+    PROFILE_TIMER(timer);
 
-    if (options.flag_ornament) {
-        ornament(image, options.pattern_value, options.color_value, options.thickness_value, options.count_value);
+    /* Information comes from the header, no pixel is decoded. */
+    if (options.flag_info) {
+        PROFILE_START(timer);
+        read_png_header(options.input_file, image);
+        PROFILE_STOP(timer, PROFILE_READ);
+        print_png_info(image);
+        png_destroy_read_struct(&image->png_ptr, &image->info_ptr, NULL);
+        return;
     }
-
-    if (options.flag_filled_rects) {
-        filled_rects(image, options.color_value, options.border_color_value, options.thickness_value);
+    /* Color replacement on indexed-color images only needs a new palette. Declining took reading the header. */
+    PROFILE_START(timer);
+    int done = palette_task_switcher(options);
+    PROFILE_STOP(timer, done ? PROFILE_PALETTE : PROFILE_READ);
+    if (done) {
+        return;
     }
+    /* Tasks not searching the whole image are streamed, only the rows copied across are decoded into memory. */
+    PROFILE_START(timer);
+    done = stream_task_switcher(options);
+    PROFILE_STOP(timer, done ? PROFILE_STREAM : PROFILE_READ);
+    if (done) {
+        return;
+    }
+
+    PROFILE_START(timer);
+    read_png_file(options.input_file, image);
+    PROFILE_STOP(timer, PROFILE_READ);
+    PROFILE_START(timer);
+    task_switcher(options, image);
+    PROFILE_STOP(timer, PROFILE_OPERATIONS);
+    PROFILE_START(timer);
+    write_png_file(options.output_file, image, &options.encoder);
+    PROFILE_STOP(timer, PROFILE_WRITE);
+
+    png_destroy_read_struct(&image->png_ptr, &image->info_ptr, NULL);
 }
@@ -0,0 +1,203 @@
+#include "errors.h"
+#include "structures.h"
+#include "storage_handler.h"
+#include "profile_handler.h"
+
+/* Number of row bands given to every thread, more bands even out rows of different cost. */
+#define BANDS_PER_THREAD 4
+
+/* The pool shared by all operations, with no worker threads it runs everything on the calling thread. */
+static ThreadPool pool = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .work_ready = PTHREAD_COND_INITIALIZER,
+    .work_done = PTHREAD_COND_INITIALIZER,
+    .thread_count = 1
+};
+
+/**
+ * @brief Runs tasks of the current job until none are left. Must be called with the pool mutex locked.
+ * 
+ * This function does not return a value.
+ */
+static void run_pending_tasks() {
+    while (pool.next_task < pool.task_count) {
+        int index = pool.next_task++;
+        pthread_mutex_unlock(&pool.mutex);
+        pool.function(index, pool.context);
+        pthread_mutex_lock(&pool.mutex);
+        if (++pool.finished_tasks == pool.task_count) {
+            pthread_cond_signal(&pool.work_done);
+        }
+    }
+}
+
+/**
+ * @brief Main loop of a worker thread: waits for a job and helps to run its tasks.
+ * 
+ * @param argument Not used.
+ * @return void* Always NULL, the workers live as long as the process.
+ */
+static void* worker_main(void *argument) {
+    int seen_generation = 0;
+    (void)argument;
+
+    pthread_mutex_lock(&pool.mutex);
+    while (1) {
+        while (pool.generation == seen_generation) {
+            pthread_cond_wait(&pool.work_ready, &pool.mutex);
+        }
+        seen_generation = pool.generation;
+        run_pending_tasks();
+    }
+
+    pthread_mutex_unlock(&pool.mutex);
+    return NULL;
+}
+
+/**
+ * @brief Starts the worker threads of the pool.
+ * 
+ * @param thread_count The total number of threads working on a job, including the calling thread.
+ * 
+ * This function does not return a value.
+ */
+void init_thread_pool(int thread_count) {
+    pool.threads = malloc(sizeof(pthread_t) * thread_count);
+    if (pool.threads == NULL) {
+        printf("Error: Can not allocate memory for threads\n");
+        exit(ERR_MEMORY_ALLOCATION_FAILURE);
+    }
+
+    /* The calling thread is one of the workers */
+    for (int i = 1; i < thread_count; i++) {
+        if (pthread_create(&pool.threads[i], NULL, worker_main, NULL) != 0) {
+            printf("Error: Can not create thread\n");
+            exit(ERR_MEMORY_ALLOCATION_FAILURE);
+        }
+    }
+    pool.thread_count = thread_count;
+}
+
+/**
+ * @brief Returns the number of threads working on a job.
+ * 
+ * @return int The number of threads, 1 if the pool was not started.
+ */
+int get_thread_count() {
+    return pool.thread_count;
+}
+
+/**
+ * @brief Returns the number of threads a job started now would run on.
+ * 
+ * @return int The number of threads, 1 if the pool was not started or is busy with another job.
+ */
+int get_free_thread_count() {
+    pthread_mutex_lock(&pool.mutex);
+    int count = pool.busy ? 1 : pool.thread_count;
+    pthread_mutex_unlock(&pool.mutex);
+    return count;
+}
+
+/**
+ * @brief Runs function for every task index from 0 to task_count - 1 on the pool and waits for all of them.
+ * 
+ * @param task_count The number of tasks.
+ * @param function The function called with every task index.
+ * @param context A pointer passed unchanged to every call of function.
+ * 
+ * This function does not return a value.
+ * 
+ * @note If the pool is busy, for example when called from inside a task, the tasks run on the calling thread.
+ */
+void run_parallel(int task_count, TaskFunction function, void *context) {
+    pthread_mutex_lock(&pool.mutex);
+    if (pool.thread_count == 1 || pool.busy || task_count < 2) {
+        pthread_mutex_unlock(&pool.mutex);
+        for (int i = 0; i < task_count; i++) {
+            function(i, context);
+        }
+        return;
+    }
+
+    /* Publish the job */
+    pool.busy = 1;
+    pool.function = function;
+    pool.context = context;
+    pool.task_count = task_count;
+    pool.next_task = 0;
+    pool.finished_tasks = 0;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.work_ready);
+
+    /* Work on it too, then wait for the others */
+    run_pending_tasks();
+    while (pool.finished_tasks < pool.task_count) {
+        pthread_cond_wait(&pool.work_done, &pool.mutex);
+    }
+    pool.busy = 0;
+    pthread_mutex_unlock(&pool.mutex);
+}
+
+/**
+ * @brief Structure passed to the tasks of parallel_rows.
+ */
+typedef struct RowBands {
+    Png *image; /**< The image whose rows are processed */
+    RowFunction function; /**< The function applied to every row */
+    void *context; /**< The context of function */
+    int band_count; /**< The number of bands the rows are split into */
+} RowBands;
+
+/**
+ * @brief Applies the row function to every row of one tile.
+ * 
+ * @param image A pointer to the Png structure representing the image.
+ * @param y_begin The first row of the tile.
+ * @param y_end The row after the last one of the tile.
+ * @param context A pointer to the RowBands structure.
+ * 
+ * This function does not return a value.
+ */
+static void run_row_tile(Png *image, int y_begin, int y_end, void *context) {
+    RowBands *bands = context;
+    for (int y = y_begin; y < y_end; y++) {
+        bands->function(image, image->row_pointers[y], y, bands->context);
+    }
+}
+
+/**
+ * @brief Applies the row function to every row of one band, a tile at a time.
+ * 
+ * @param index The index of the band.
+ * @param context A pointer to the RowBands structure.
+ * 
+ * This function does not return a value.
+ */
+static void run_row_band(int index, void *context) {
+    RowBands *bands = context;
+    int rows = bands->image->rows_end - bands->image->rows_begin;
+    int y_begin = bands->image->rows_begin + (int)((long long)rows * index / bands->band_count);
+    int y_end = bands->image->rows_begin + (int)((long long)rows * (index + 1) / bands->band_count);
+    for_each_tile(bands->image, y_begin, y_end, run_row_tile, bands);
+}
+
+/**
+ * @brief Applies a row function to every row of the image held in memory, splitting the rows into bands run on the pool.
+ * 
+ * @param image A pointer to the Png structure representing the image.
+ * @param function The function applied to every row.
+ * @param context A pointer passed unchanged to every call of function.
+ * 
+ * This function does not return a value.
+ * 
+ * @note The function must only write to the row it is given, then the result does not depend on the number of threads.
+ */
+void parallel_rows(Png *image, RowFunction function, void *context) {
+    RowBands bands = {image, function, context, pool.thread_count * BANDS_PER_THREAD};
+    if (bands.band_count > image->rows_end - image->rows_begin) {
+        bands.band_count = image->rows_end - image->rows_begin;
+    }
+    PROFILE_COUNT(pixels_visited, (uint64_t)image->width * (image->rows_end - image->rows_begin));
+    run_parallel(bands.band_count, run_row_band, &bands);
+}